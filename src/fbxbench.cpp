@@ -0,0 +1,348 @@
+#include <stdint.h>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "fbxdocument.h"
+#include "fbxjson.h"
+#include "fbxmesh.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using namespace fbx;
+
+// Benchmarks reading, writing, round-tripping, dumping and mesh extraction of
+// a synthetic scene (or of a given file) and prints the results as JSON.
+//
+// fbxbench [--geometries N] [--vertices N] [--compress] [--version V]
+//          [--iterations N] [--threads N] [--input file] [--output file] [--help]
+
+namespace {
+    struct Settings {
+        size_t geometries = 100;
+        size_t vertices = 10000;
+        bool compress = false;
+        uint32_t version = 7400;
+        int iterations = 5;
+        unsigned threads = 0;
+        string input;
+        string output;
+    };
+
+    // xorshift, the same sequence on every platform
+    class Random {
+    public:
+        Random(uint64_t seed):state(seed) {}
+        uint64_t next() {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        }
+        // multiple of 0.001 in [-100, 100)
+        double coordinate() {
+            return (int64_t) (next() % 200000) / 1000.0 - 100.0;
+        }
+    private:
+        uint64_t state;
+    };
+
+    string objectName(const string &name, const string &cls)
+    {
+        return name + string("\x00\x01", 2) + cls;
+    }
+
+    // a mesh of quads over vertices consecutive vertices with per corner normals
+    FBXNode geometry(int64_t id, size_t vertices, Random &random)
+    {
+        FBXNode geometry("Geometry");
+        geometry.addProperty(id);
+        geometry.addProperty(objectName("Mesh" + std::to_string(id), "Geometry"));
+        geometry.addProperty("Mesh");
+        geometry.addPropertyNode("GeometryVersion", (int32_t) 124);
+
+        std::vector<double> positions(vertices * 3);
+        for(auto &c : positions) c = random.coordinate();
+        geometry.addPropertyNode("Vertices", positions);
+
+        std::vector<int32_t> indices(vertices - vertices % 4);
+        for(size_t i = 0; i < indices.size(); i++) {
+            // the last index of every polygon is stored as -(index + 1)
+            indices[i] = i % 4 == 3 ? -(int32_t) i - 1 : (int32_t) i;
+        }
+        geometry.addPropertyNode("PolygonVertexIndex", indices);
+
+        FBXNode &normals = geometry.emplaceChild("LayerElementNormal");
+        normals.addProperty((int32_t) 0);
+        normals.addPropertyNode("Version", (int32_t) 101);
+        normals.addPropertyNode("Name", "");
+        normals.addPropertyNode("MappingInformationType", "ByPolygonVertex");
+        normals.addPropertyNode("ReferenceInformationType", "Direct");
+        std::vector<double> directions(indices.size() * 3);
+        for(auto &c : directions) c = random.coordinate() / 100.0;
+        normals.addPropertyNode("Normals", directions);
+        return geometry;
+    }
+
+    FBXNode model(int64_t id)
+    {
+        FBXNode model("Model");
+        model.addProperty(id);
+        model.addProperty(objectName("Model" + std::to_string(id), "Model"));
+        model.addProperty("Mesh");
+        model.addPropertyNode("Version", (int32_t) 232);
+        FBXNode &properties = model.emplaceChild("Properties70");
+        FBXNode &p = properties.emplaceChild("P");
+        p.addProperty("Lcl Translation");
+        p.addProperty("Lcl Translation");
+        p.addProperty("");
+        p.addProperty("A");
+        p.addProperty((double) id);
+        p.addProperty(0.0);
+        p.addProperty(0.0);
+        return model;
+    }
+
+    FBXNode connection(int64_t child, int64_t parent)
+    {
+        FBXNode c("C");
+        c.addProperty("OO");
+        c.addProperty(child);
+        c.addProperty(parent);
+        return c;
+    }
+
+    // deterministic scene: the basic structure plus geometries models with a
+    // mesh each, connected to the root
+    void generate(FBXDocument &document, const Settings &settings)
+    {
+        // FBXHeaderExtension/FBXVersion is taken from the document version
+        document.setVersion(settings.version);
+        document.createBasicStructure();
+        Random random(0x9e3779b97f4a7c15ull);
+        FBXNode objects("Objects");
+        FBXNode connections("Connections");
+        for(size_t i = 0; i < settings.geometries; i++) {
+            int64_t geometryId = 1000000 + 2 * i;
+            int64_t modelId = geometryId + 1;
+            objects.addChild(geometry(geometryId, settings.vertices, random));
+            objects.addChild(model(modelId));
+            connections.addChild(connection(geometryId, modelId));
+            connections.addChild(connection(modelId, 0));
+        }
+        document.nodes.push_back(std::move(objects));
+        document.nodes.push_back(std::move(connections));
+    }
+
+    size_t countNodes(const FBXNode &node)
+    {
+        if(node.isNull()) return 0;
+        size_t count = 1;
+        for(auto &child : node.getChildren()) count += countNodes(child);
+        return count;
+    }
+
+    size_t countNodes(const FBXDocument &document)
+    {
+        size_t count = 0;
+        for(auto &node : document.nodes) count += countNodes(node);
+        return count;
+    }
+
+    // median of the wall clock times of iterations runs of job, setup runs
+    // before each of them and isn't timed
+    template<typename Setup, typename Job>
+    double measure(int iterations, Setup setup, Job job)
+    {
+        std::vector<double> times;
+        for(int i = 0; i < iterations; i++) {
+            setup();
+            auto start = std::chrono::steady_clock::now();
+            job();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            times.push_back(elapsed.count());
+        }
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    }
+
+    template<typename Job>
+    double measure(int iterations, Job job)
+    {
+        return measure(iterations, []() {}, job);
+    }
+
+    string jsonString(const string &s)
+    {
+        std::vector<uint8_t> json;
+        {
+            Writer writer(&json, 64);
+            FBXJsonWriter(writer).quoted(s);
+        }
+        return string(json.begin(), json.end());
+    }
+
+    // whole argument as a decimal number
+    template<typename T>
+    bool parseNumber(const string &arg, T &value)
+    {
+        const char *end = arg.data() + arg.size();
+        auto result = std::from_chars(arg.data(), end, value);
+        return !arg.empty() && result.ec == std::errc() && result.ptr == end;
+    }
+
+    void usage(std::ostream &output, const char *program)
+    {
+        output << "Usage: " << program << " [--geometries N] [--vertices N] [--compress] [--version V]"
+               << " [--iterations N] [--threads N] [--input file] [--output file] [--help]" << endl;
+    }
+
+    void printResult(const char *name, double seconds, size_t bytes, size_t nodes, bool last)
+    {
+        printf("    \"%s\": { \"seconds\": %.6f, \"mb_per_s\": %.2f, \"nodes_per_s\": %.0f }%s\n",
+               name, seconds, bytes / seconds / 1e6, nodes / seconds, last ? "" : ",");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Settings settings;
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "--help") {
+            usage(std::cout, argv[0]);
+            return 0;
+        }
+        bool hasValue = i + 1 < argc;
+        bool valid = true;
+        if(arg == "--compress") settings.compress = true;
+        else if(arg == "--geometries" && hasValue) valid = parseNumber(argv[++i], settings.geometries);
+        else if(arg == "--vertices" && hasValue) valid = parseNumber(argv[++i], settings.vertices);
+        else if(arg == "--version" && hasValue) valid = parseNumber(argv[++i], settings.version);
+        else if(arg == "--iterations" && hasValue) valid = parseNumber(argv[++i], settings.iterations);
+        else if(arg == "--threads" && hasValue) valid = parseNumber(argv[++i], settings.threads);
+        else if(arg == "--input" && hasValue) settings.input = argv[++i];
+        else if(arg == "--output" && hasValue) settings.output = argv[++i];
+        else {
+            usage(cerr, argv[0]);
+            return 1;
+        }
+        if(!valid) {
+            cerr << "Invalid number for " << arg << ": " << argv[i] << endl;
+            usage(cerr, argv[0]);
+            return 1;
+        }
+    }
+    settings.iterations = std::max(1, settings.iterations);
+
+    try {
+        FBXReadOptions readOptions;
+        readOptions.decompressionThreads = settings.threads;
+        readOptions.parseThreads = settings.threads;
+        FBXWriteOptions writeOptions;
+        writeOptions.compressArrays = settings.compress;
+        writeOptions.compressionThreads = settings.threads;
+
+        FBXDocument scene;
+        if(settings.input.empty()) {
+            generate(scene, settings);
+        } else {
+            scene.read(settings.input, readOptions);
+        }
+
+        // the serialized scene everything else works on, kept in memory so the
+        // disk doesn't show up in the numbers
+        std::vector<uint8_t> file;
+        {
+            FBXDocument copy = scene;
+            Writer writer(&file);
+            copy.write(writer, writeOptions);
+            writer.flush();
+        }
+        if(!settings.output.empty()) {
+            std::ofstream output(settings.output, std::ios::out | std::ios::binary);
+            output.write((const char*) file.data(), file.size());
+            if(!output) throw string("Cannot write to file: \"" + settings.output + "\"");
+        }
+        size_t nodes = countNodes(scene);
+
+        auto read = [&](FBXDocument &document) {
+            Reader reader((const char*) file.data(), file.size());
+            document.read(reader, readOptions);
+        };
+
+        // a fresh copy for every run, written documents keep their compressed arrays
+        FBXDocument copy;
+        double writeTime = measure(settings.iterations, [&]() { copy = scene; }, [&]() {
+            std::vector<uint8_t> output;
+            output.reserve(file.size());
+            Writer writer(&output);
+            copy.write(writer, writeOptions);
+            writer.flush();
+        });
+        double readTime = measure(settings.iterations, [&]() {
+            FBXDocument document;
+            read(document);
+        });
+        double roundTripTime = measure(settings.iterations, [&]() {
+            FBXDocument document;
+            read(document);
+            std::vector<uint8_t> output;
+            Writer writer(&output);
+            document.write(writer, writeOptions);
+            writer.flush();
+        });
+        FBXDocument loaded;
+        read(loaded);
+        size_t dumpBytes = 0;
+        double dumpTime = measure(settings.iterations, [&]() {
+            std::vector<uint8_t> json;
+            Writer writer(&json);
+            FBXJsonWriter(writer).write(loaded);
+            writer.flush();
+            dumpBytes = json.size();
+        });
+
+        size_t triangles = 0;
+        double extractTime = measure(settings.iterations, [&]() {
+            triangles = 0;
+            for(auto &mesh : extractMeshes(loaded, settings.threads)) triangles += mesh.triangles.size() / 3;
+        });
+
+        printf("{\n");
+        printf("  \"scene\": {\n");
+        if(settings.input.empty()) {
+            printf("    \"geometries\": %zu,\n", settings.geometries);
+            printf("    \"vertices\": %zu,\n", settings.vertices);
+        } else {
+            printf("    \"input\": %s,\n", jsonString(settings.input).c_str());
+        }
+        printf("    \"version\": %u,\n", scene.getVersion());
+        printf("    \"compress\": %s,\n", settings.compress ? "true" : "false");
+        printf("    \"nodes\": %zu,\n", nodes);
+        printf("    \"bytes\": %zu,\n", file.size());
+        printf("    \"json_bytes\": %zu,\n", dumpBytes);
+        printf("    \"triangles\": %zu\n", triangles);
+        printf("  },\n");
+        printf("  \"iterations\": %d,\n", settings.iterations);
+        printf("  \"threads\": %u,\n", settings.threads);
+        printf("  \"results\": {\n");
+        printResult("write", writeTime, file.size(), nodes, false);
+        printResult("read", readTime, file.size(), nodes, false);
+        printResult("roundtrip", roundTripTime, file.size(), nodes, false);
+        printResult("dump", dumpTime, file.size(), nodes, false);
+        printResult("extract", extractTime, file.size(), nodes, true);
+        printf("  }\n");
+        printf("}\n");
+    } catch(string e) {
+        cerr << "ERROR: " << e << endl;
+        return 2;
+    }
+    return 0;
+}
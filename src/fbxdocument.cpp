@@ -1,5 +1,10 @@
 #include "fbxdocument.h"
 #include "fbxutil.h"
+#include "fbxjson.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 
 using std::string;
 using std::cout;
@@ -7,6 +12,7 @@ using std::endl;
 using std::ifstream;
 using std::ofstream;
 using std::uint32_t;
+using std::uint64_t;
 using std::uint8_t;
 
 namespace fbx {
@@ -17,6 +23,29 @@ FBXDocument::FBXDocument()
 
 void FBXDocument::read(string fname)
 {
+    read(fname, FBXReadOptions());
+}
+
+void FBXDocument::read(string fname, const FBXReadOptions &options)
+{
+    if(options.mapFile) {
+        auto mapping = std::make_shared<const MappedFile>(fname, options.prefetch);
+        std::shared_ptr<const void> owner;
+        if(options.zeroCopy || options.keepRecords) owner = mapping;
+        Reader reader(mapping->data(), mapping->size(), owner);
+        read(reader, options);
+        return;
+    }
+
+    if(options.prefetch) {
+        PrefetchBuffer prefetch(fname, options.prefetchChunkSize, options.prefetchChunks);
+        std::istream input(&prefetch);
+        input.exceptions(std::ios::badbit);
+        Reader reader(&input);
+        read(reader, options);
+        return;
+    }
+
     ifstream file;
 
     // buffer
@@ -26,7 +55,9 @@ void FBXDocument::read(string fname)
 
     file.open(fname, std::ios::in | std::ios::binary);
     if (file.is_open()) {
-        read(file);
+        Reader reader(&file);
+        file >> std::noskipws;
+        read(reader, options);
     } else {
         throw std::string("Cannot read from file: \"" + fname + "\"");
     }
@@ -35,94 +66,208 @@ void FBXDocument::read(string fname)
 
 void FBXDocument::write(string fname)
 {
-    ofstream file;
-
-    // buffer
-    int bufferSize = 1 << 16;
-    char buffer[bufferSize];
-    file.rdbuf()->pubsetbuf(buffer, bufferSize);
+    write(fname, FBXWriteOptions());
+}
 
+void FBXDocument::write(string fname, const FBXWriteOptions &options)
+{
+    ofstream file;
     file.open(fname, std::ios::out | std::ios::binary);
     if (file.is_open()) {
-        write(file);
+        write(file, options);
     } else {
         throw std::string("Cannot write to file: \"" + fname + "\"");
     }
     file.close();
 }
 
-bool checkMagic(Reader &reader)
-{
-    string magic("Kaydara FBX Binary  ");
-    for(char c : magic) {
-        if(reader.readUint8() != c) return false;
-    }
-    if(reader.readUint8() != 0x00) return false;
-    if(reader.readUint8() != 0x1A) return false;
-    if(reader.readUint8() != 0x00) return false;
-    return true;
-}
-
 void FBXDocument::read(std::ifstream &input)
 {
     Reader reader(&input);
     input >> std::noskipws;
+    read(reader);
+}
+
+void FBXDocument::read(Reader &reader, const FBXReadOptions &options)
+{
+    auto readStart = std::chrono::steady_clock::now();
+    FBXStats *collected = options.collectStats ? &stats : nullptr;
+    stats = FBXStats();
+    index.clear();
     if(!checkMagic(reader)) throw std::string("Not a FBX file");
 
-    uint32_t version = reader.readUint32();
+    setVersion(reader.readUint32());
+
+    // parallel parsing needs to read anywhere in the input at any time
+    unsigned parseThreads = reader.isMemoryBacked() ? options.parseThreads : 0;
+    unsigned inflateThreads = options.decompressionThreads ? options.decompressionThreads : parseThreads;
+    // defer decompression so it can be done in parallel below
+    FBXReadOptions parseOptions = options;
+    bool parallel = inflateThreads > 0 && !options.lazyDecompression;
+    if(parallel) parseOptions.lazyDecompression = true;
 
-    uint32_t maxVersion = 7400;
-    if(version > maxVersion) throw "Unsupported FBX version "+std::to_string(version)
-                            + " latest supported version is "+std::to_string(maxVersion);
+    auto wanted = [&](const std::string &name) {
+        if(options.sectionFilter) return options.sectionFilter(name);
+        return options.sections.empty() || options.sections.count(name) > 0;
+    };
+    bool selective = options.sectionFilter || !options.sections.empty();
 
-    uint32_t start_offset = 27; // magic: 21+2, version: 4
+    if(!strings) strings = std::make_shared<StringPool>();
+    reader.setStringPool(strings);
+    if(options.useArena) {
+        if(!arena) arena = std::make_shared<Arena>();
+        reader.setArena(arena);
+    }
+    FBXNode::allocator_type allocator(options.useArena ? arena.get() : std::pmr::get_default_resource());
+
+    // children of top level nodes left for the parallel parse
+    struct Scanned {
+        size_t node;
+        std::vector<uint64_t> offsets;
+        uint64_t end;
+    };
+    std::vector<Scanned> scanned;
+
+    uint64_t start_offset = 27; // magic: 21+2, version: 4
     do{
-        FBXNode node;
-        start_offset += node.read(input, start_offset);
-        if(node.isNull()) break;
-        nodes.push_back(node);
+        if(selective) {
+            uint64_t position = reader.tell();
+            FBXNodeHeader header;
+            header.read(reader, version);
+            if(header.endOffset != 0 && !wanted(header.name)) {
+                reader.seek(header.endOffset);
+                start_offset = header.endOffset;
+                continue;
+            }
+            reader.seek(position);
+        }
+        FBXNode node(allocator);
+        if(parseThreads > 0) {
+            std::vector<uint64_t> offsets;
+            uint64_t bytes = node.readShallow(reader, start_offset, parseOptions, version, collected, offsets);
+            start_offset += bytes;
+            if(offsets.empty()) {
+                if(node.isNull()) break;
+            } else {
+                scanned.push_back({nodes.size(), std::move(offsets), start_offset});
+            }
+        } else {
+            start_offset += node.read(reader, start_offset, parseOptions, version, collected);
+            if(node.isNull()) break;
+        }
+        nodes.push_back(std::move(node));
     } while(true);
-}
 
-namespace {
-    void writerFooter(Writer &writer) {
-        uint8_t footer[] = {
-            0xfa, 0xbc, 0xab, 0x09,
-            0xd0, 0xc8, 0xd4, 0x66, 0xb1, 0x76, 0xfb, 0x83, 0x1c, 0xf7, 0x26, 0x7e, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0xe8, 0x1c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf8, 0x5a, 0x8c, 0x6a,
-            0xde, 0xf5, 0xd9, 0x7e, 0xec, 0xe9, 0x0c, 0xe3, 0x75, 0x8f, 0x29, 0x0b
+    if(!scanned.empty()) {
+        // neighbouring children are parsed in batches of about the same size,
+        // handed out one by one so the threads stay busy till the end
+        struct Batch {
+            FBXNode *parent;
+            const std::vector<uint64_t> *offsets;
+            size_t first;
+            size_t last;
         };
-        for(unsigned int i = 0; i < sizeof(footer); i++) {
-            writer.write(footer[i]);
+        uint64_t total = 0;
+        for(auto &s : scanned) total += s.end - s.offsets.front();
+        uint64_t target = std::max<uint64_t>(total / (parseThreads * 16), 1);
+        std::vector<Batch> batches;
+        for(auto &s : scanned) {
+            FBXNode &parent = nodes[s.node];
+            size_t first = 0;
+            for(size_t i = 0; i < s.offsets.size(); i++) {
+                uint64_t next = i + 1 < s.offsets.size() ? s.offsets[i + 1] : s.end;
+                if(next - s.offsets[first] >= target || i + 1 == s.offsets.size()) {
+                    batches.push_back({&parent, &s.offsets, first, i + 1});
+                    first = i + 1;
+                }
+            }
         }
+        std::vector<FBXStats> batchStats(collected ? batches.size() : 0);
+        parallelFor(batches.size(), parseThreads, [&](size_t b) {
+            const Batch &batch = batches[b];
+            // copies share the input, arena and string pool
+            Reader batchReader(reader);
+            for(size_t i = batch.first; i < batch.last; i++) {
+                uint64_t offset = (*batch.offsets)[i];
+                batchReader.seek(offset);
+                batch.parent->begin()[i].read(batchReader, offset, parseOptions, version,
+                                              collected ? &batchStats[b] : nullptr);
+            }
+        });
+        for(auto &counts : batchStats) stats.merge(counts);
+    }
+    stats.bytes = reader.tell();
+    std::chrono::duration<double> parseTime = std::chrono::steady_clock::now() - readStart;
+    stats.parseSeconds = parseTime.count() - stats.decompressSeconds;
+
+    if(parallel) {
+        std::vector<FBXProperty*> pending;
+        for(auto &node : nodes) node.collectArrays(pending);
+        pending.erase(std::remove_if(pending.begin(), pending.end(), [](FBXProperty *prop) {
+            return !prop->isCompressed();
+        }), pending.end());
+        // like the eager path, keep the compressed bytes when asked to or when they are free
+        bool keepEncoded = options.keepEncoded || reader.returnsViews();
+        std::atomic<int64_t> nanoseconds(0);
+        parallelFor(pending.size(), inflateThreads, [&](size_t i) {
+            auto start = std::chrono::steady_clock::now();
+            if(keepEncoded) pending[i]->inflate();
+            else pending[i]->decompress();
+            if(collected) nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                             std::chrono::steady_clock::now() - start).count();
+        });
+        stats.decompressSeconds += nanoseconds * 1e-9;
     }
 
+    if(options.deduplicateArrays) stats.dedup = deduplicateArrays(inflateThreads);
+    if(options.buildIndex) buildIndex();
+    std::chrono::duration<double> totalTime = std::chrono::steady_clock::now() - readStart;
+    stats.totalSeconds = totalTime.count();
+    if(!collected) stats = FBXStats();
+}
+
+const FBXStats &FBXDocument::getStats() const
+{
+    return stats;
+}
+
+FBXDedupStats FBXDocument::deduplicateArrays(unsigned threads)
+{
+    std::vector<FBXProperty*> arrays;
+    for(auto &node : nodes) node.collectArrays(arrays);
+    return FBXProperty::deduplicate(arrays, threads);
 }
 
 void FBXDocument::write(std::ofstream &output)
+{
+    write(output, FBXWriteOptions());
+}
+
+void FBXDocument::write(std::ofstream &output, const FBXWriteOptions &options)
 {
     Writer writer(&output);
-    writer.write("Kaydara FBX Binary  ");
-    writer.write((uint8_t) 0);
-    writer.write((uint8_t) 0x1A);
-    writer.write((uint8_t) 0);
-    writer.write(version);
-
-    uint32_t offset = 27; // magic: 21+2, version: 4
-    for(FBXNode node : nodes) {
-        offset += node.write(output, offset);
+    write(writer, options);
+    writer.flush();
+}
+
+void FBXDocument::write(Writer &writer, const FBXWriteOptions &options)
+{
+    // sizes depend on the encoding, so settle it for all arrays up front
+    std::vector<FBXProperty*> arrays;
+    for(auto &node : nodes) node.collectArrays(arrays);
+    parallelFor(arrays.size(), options.compressionThreads, [&](size_t i) {
+        arrays[i]->encode(options);
+    });
+
+    writeHeader(writer, version);
+
+    uint64_t offset = 27; // magic: 21+2, version: 4
+    for(auto &node : nodes) {
+        offset += node.write(writer, offset, version);
     }
     FBXNode nullNode;
-    offset += nullNode.write(output, offset);
-    writerFooter(writer);
+    offset += nullNode.write(writer, offset, version);
+    writeFooter(writer, version);
 }
 
 void FBXDocument::createBasicStructure()
@@ -141,7 +286,7 @@ void FBXDocument::createBasicStructure()
         creationTimeStamp.addPropertyNode("Minute", (int32_t) 11);
         creationTimeStamp.addPropertyNode("Second", (int32_t) 46);
         creationTimeStamp.addPropertyNode("Millisecond", (int32_t) 917);
-        headerExtension.addChild(creationTimeStamp);
+        headerExtension.addChild(std::move(creationTimeStamp));
     }
     headerExtension.addPropertyNode("Creator", "Blender (stable FBX IO) - 2.78 (sub 0) - 3.7.7");
     {
@@ -159,7 +304,7 @@ void FBXDocument::createBasicStructure()
             metadata.addPropertyNode("Keywords", "");
             metadata.addPropertyNode("Revision", "");
             metadata.addPropertyNode("Comment", "");
-            sceneInfo.addChild(metadata);
+            sceneInfo.addChild(std::move(metadata));
         }
         {
             FBXNode properties("Properties70");
@@ -170,7 +315,7 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("Url");
                 p.addProperty("");
                 p.addProperty("/foobar.fbx");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
             {
                 FBXNode p("P");
@@ -179,7 +324,7 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("Url");
                 p.addProperty("");
                 p.addProperty("/foobar.fbx");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
             {
                 FBXNode p("P");
@@ -187,7 +332,7 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("Compound");
                 p.addProperty("");
                 p.addProperty("");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
             {
                 FBXNode p("P");
@@ -196,7 +341,7 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("");
                 p.addProperty("");
                 p.addProperty("Blender Foundation");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
             {
                 FBXNode p("P");
@@ -205,7 +350,7 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("");
                 p.addProperty("");
                 p.addProperty("Blender (stable FBX IO)");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
             {
                 FBXNode p("P");
@@ -214,7 +359,7 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("");
                 p.addProperty("");
                 p.addProperty("2.78 (sub 0)");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
             {
                 FBXNode p("P");
@@ -223,7 +368,7 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("");
                 p.addProperty("");
                 p.addProperty("01/01/1970 00:00:00.000");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
             {
                 FBXNode p("P");
@@ -232,7 +377,7 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("");
                 p.addProperty("");
                 p.addProperty("/foobar.fbx");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
             {
                 FBXNode p("P");
@@ -240,7 +385,7 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("Compound");
                 p.addProperty("");
                 p.addProperty("");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
             {
                 FBXNode p("P");
@@ -249,7 +394,7 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("");
                 p.addProperty("");
                 p.addProperty("Blender Foundation");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
             {
                 FBXNode p("P");
@@ -258,7 +403,7 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("");
                 p.addProperty("");
                 p.addProperty("Blender (stable FBX IO)");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
             {
                 FBXNode p("P");
@@ -267,34 +412,86 @@ void FBXDocument::createBasicStructure()
                 p.addProperty("");
                 p.addProperty("");
                 p.addProperty("01/01/1970 00:00:00.000");
-                properties.addChild(p);
+                properties.addChild(std::move(p));
             }
-            sceneInfo.addChild(properties);
+            sceneInfo.addChild(std::move(properties));
         }
-        headerExtension.addChild(sceneInfo);
+        headerExtension.addChild(std::move(sceneInfo));
     }
-    nodes.push_back(headerExtension);
+    nodes.push_back(std::move(headerExtension));
 
 
 }
 
-std::uint32_t FBXDocument::getVersion()
+std::uint32_t FBXDocument::getVersion() const
 {
     return version;
 }
 
-void FBXDocument::print()
+void FBXDocument::setVersion(std::uint32_t version)
+{
+    checkVersion(version);
+    this->version = version;
+}
+
+void FBXDocument::NodeIndex::clear()
 {
-    cout << "{\n";
-    cout << "  \"version\": " << getVersion() << ",\n";
-    cout << "  \"children\": [\n";
-    bool hasPrev = false;
-    for(auto node : nodes) {
-        if(hasPrev) cout << ",\n";
-        node.print("    ");
-        hasPrev = true;
+    built = false;
+    byName.clear();
+    byPath.clear();
+}
+
+void FBXDocument::buildIndex()
+{
+    index.clear();
+    for(auto &node : nodes) indexNode(node, std::string(node.getName()));
+    index.built = true;
+}
+
+void FBXDocument::indexNode(FBXNode &node, const std::string &path)
+{
+    if(node.isNull()) return;
+    index.byName[node.getName()].push_back(&node);
+    index.byPath[path].push_back(&node);
+    for(auto &child : node) {
+        indexNode(child, path + "/" + std::string(child.getName()));
     }
-    cout << "\n  ]\n}" << endl;
+}
+
+FBXNode *FBXDocument::findNode(const std::string &name)
+{
+    auto &found = findNodes(name);
+    return found.empty() ? NULL : found.front();
+}
+
+namespace {
+    const std::vector<FBXNode*> noNodes;
+}
+
+const std::vector<FBXNode*> &FBXDocument::findNodes(const std::string &name)
+{
+    if(!index.built) buildIndex();
+    auto it = index.byName.find(name);
+    return it == index.byName.end() ? noNodes : it->second;
+}
+
+const std::vector<FBXNode*> &FBXDocument::findNodesByPath(const std::string &path)
+{
+    if(!index.built) buildIndex();
+    auto it = index.byPath.find(path);
+    return it == index.byPath.end() ? noNodes : it->second;
+}
+
+void FBXDocument::print() const
+{
+    print(FBXJsonOptions());
+}
+
+void FBXDocument::print(const FBXJsonOptions &options) const
+{
+    Writer writer(&cout);
+    FBXJsonWriter(writer, options).write(*this);
+    writer.flush();
 }
 
 } // namespace fbx
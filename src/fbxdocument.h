@@ -3,26 +3,75 @@
 
 #include "fbxnode.h"
 
+#include <unordered_map>
+
 namespace fbx {
 
 class FBXDocument
 {
+private:
+    // declared before nodes so they outlive them
+    std::shared_ptr<Arena> arena;
+    std::shared_ptr<StringPool> strings;
+
 public:
     FBXDocument();
     void read(std::ifstream &input);
     void read(std::string fname);
+    void read(std::string fname, const FBXReadOptions &options);
+    void read(Reader &reader, const FBXReadOptions &options = FBXReadOptions());
     void write(std::string fname);
+    void write(std::string fname, const FBXWriteOptions &options);
     void write(std::ofstream &output);
+    void write(std::ofstream &output, const FBXWriteOptions &options);
+    void write(Writer &writer, const FBXWriteOptions &options = FBXWriteOptions());
 
     void createBasicStructure();
 
     std::vector<FBXNode> nodes;
 
-    std::uint32_t getVersion();
-    void print();
+    // statistics of the last read() with FBXReadOptions::collectStats,
+    // empty otherwise
+    const FBXStats &getStats() const;
+
+    std::uint32_t getVersion() const;
+    // version used for writing, 7500 and later allow files above 4GB
+    void setVersion(std::uint32_t version);
+    // shares identical array payloads between properties (see
+    // FBXProperty::deduplicate), hashing them on up to threads threads
+    FBXDedupStats deduplicateArrays(unsigned threads = 0);
+
+    // JSON dump to stdout
+    void print() const;
+    void print(const FBXJsonOptions &options) const;
+
+    // O(1) lookups through an index of node names and paths such as
+    // "Objects/Geometry/Vertices", nodes are listed in document order.
+    // The index is built on first use (or by read() with buildIndex), call
+    // buildIndex() again after changing the node tree.
+    void buildIndex();
+    FBXNode *findNode(const std::string &name);
+    const std::vector<FBXNode*> &findNodes(const std::string &name);
+    const std::vector<FBXNode*> &findNodesByPath(const std::string &path);
 
 private:
+    // copies don't inherit the index, it points into the original's nodes
+    struct NodeIndex {
+        NodeIndex() {}
+        NodeIndex(const NodeIndex&) {}
+        NodeIndex &operator=(const NodeIndex&) { clear(); return *this; }
+        void clear();
+
+        bool built = false;
+        // keys view the names of the indexed nodes
+        std::unordered_map<std::string_view, std::vector<FBXNode*>> byName;
+        std::unordered_map<std::string, std::vector<FBXNode*>> byPath;
+    };
+    void indexNode(FBXNode &node, const std::string &path);
+
     std::uint32_t version;
+    NodeIndex index;
+    FBXStats stats;
 };
 
 } // namespace fbx
@@ -1,42 +1,88 @@
 #include <stdint.h>
+#include <charconv>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "fbxdocument.h"
+#include "fbxjson.h"
 using std::cout;
 using std::cerr;
 using std::endl;
 using std::string;
 using namespace fbx;
 
-bool findNode(std::string name, FBXNode where) {
-    if(where.getName() == name) {
-        where.print();
-        return true;
+namespace {
+    // whole argument as a non-negative decimal number
+    bool parseCount(const string &arg, std::size_t &value)
+    {
+        const char *end = arg.data() + arg.size();
+        auto result = std::from_chars(arg.data(), end, value);
+        return !arg.empty() && result.ec == std::errc() && result.ptr == end;
     }
-    for(FBXNode n : where.getChildren()) {
-        if(findNode(name, n)) {
-            return true;
-        }
+
+    void usage(const char *program)
+    {
+        cerr << "Usage: " << program << " [--compact] [--max-array N] [--stats] file [query]" << endl;
     }
-    return false;
 }
 
 int main(int argc, char** argv) {
-    if(argc < 2) {
+    // fbxdump [--compact] [--max-array N] [--stats] file [query]
+    fbx::FBXJsonOptions jsonOptions;
+    bool stats = false;
+    std::vector<string> args;
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "--stats") {
+            stats = true;
+        } else if(arg == "--compact") {
+            jsonOptions.compact = true;
+        } else if(arg == "--max-array" && i + 1 < argc) {
+            if(!parseCount(argv[++i], jsonOptions.maxArrayElements)) {
+                cerr << "Invalid number for --max-array: " << argv[i] << endl;
+                usage(argv[0]);
+                return 1;
+            }
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if(args.empty()) {
         cerr << "Specify file which you want to dump" << endl;
+        usage(argv[0]);
         return 1;
     }
 
     try {
         fbx::FBXDocument d;
-        d.read(argv[1]);
-        if(argc >= 3) {
-            for(auto n : d.nodes) {
-                if(findNode(argv[2], n)) break;
+        fbx::FBXReadOptions options;
+        options.zeroCopy = true;
+        // queries usually touch few arrays, decompress only what gets printed
+        options.lazyDecompression = args.size() >= 2 && !stats;
+        options.collectStats = stats;
+        // reports how much of the array data is repeated
+        options.deduplicateArrays = stats;
+        options.decompressionThreads = std::thread::hardware_concurrency();
+        d.read(args[0], options);
+        if(stats) {
+            // what the file is made of instead of its contents
+            fbx::Writer writer(&std::cout);
+            fbx::FBXJsonWriter(writer, jsonOptions).write(d.getStats());
+            writer.flush();
+        } else if(args.size() >= 2) {
+            // "Objects/Geometry" looks up a path, "Geometry" a node name
+            string query = args[1];
+            bool isPath = query.find('/') != string::npos;
+            auto &found = isPath ? d.findNodesByPath(query) : d.findNodes(query);
+            if(!found.empty()) {
+                fbx::Writer writer(&std::cout);
+                fbx::FBXJsonWriter(writer, jsonOptions).write(*found.front());
+                writer.flush();
             }
         } else {
-            d.print();
+            d.print(jsonOptions);
         }
 
     } catch(string s) {
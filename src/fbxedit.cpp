@@ -0,0 +1,61 @@
+#include "fbxedit.h"
+
+#include <cstdio>
+
+using std::string;
+
+namespace fbx {
+
+namespace {
+    FBXReadOptions editOptions()
+    {
+        FBXReadOptions options;
+        options.lazyDecompression = true;
+        options.buildIndex = true;
+        return options;
+    }
+}
+
+FBXEditSession::FBXEditSession(const string &fname)
+    :FBXEditSession(fname, editOptions())
+{}
+
+FBXEditSession::FBXEditSession(const string &fname, FBXReadOptions options)
+    :source(fname)
+{
+    options.mapFile = true;
+    options.keepRecords = true;
+    // save() writes the whole document back, skipped sections would be lost
+    options.sections.clear();
+    options.sectionFilter = nullptr;
+    document.read(fname, options);
+}
+
+FBXDocument &FBXEditSession::getDocument()
+{
+    return document;
+}
+
+void FBXEditSession::save(const FBXWriteOptions &options)
+{
+    save(source, options);
+}
+
+void FBXEditSession::save(const string &fname, const FBXWriteOptions &options)
+{
+    // the records are views of the mapped source, it must stay intact until
+    // the new file is complete; the old file lives on as long as it's mapped
+    string temporary = fname + ".tmp";
+    try {
+        document.write(temporary, options);
+    } catch(...) {
+        std::remove(temporary.c_str());
+        throw;
+    }
+    if(std::rename(temporary.c_str(), fname.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw string("Cannot replace file: \"" + fname + "\"");
+    }
+}
+
+} // namespace fbx
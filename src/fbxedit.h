@@ -0,0 +1,42 @@
+#ifndef FBXEDIT_H
+#define FBXEDIT_H
+
+#include "fbxdocument.h"
+
+namespace fbx {
+
+// Changes a few nodes of a (possibly huge) file without rewriting all of it.
+// The file is read with node records kept and arrays left compressed, save()
+// copies every unchanged subtree from the file and serialises only the nodes
+// that were changed and their ancestors, shifting the endOffsets behind them.
+//
+//     FBXEditSession session("scene.fbx");
+//     for(FBXNode *p : session.getDocument().findNodesByPath("GlobalSettings/Properties70/P")) {
+//         const FBXNode &read = *p; // the non-const accessors mark the node modified
+//         if(read.getProperties()[0].getString() != "UnitScaleFactor") continue;
+//         p->getProperties()[4] = FBXProperty(100.0);
+//     }
+//     session.save();
+class FBXEditSession
+{
+public:
+    explicit FBXEditSession(const std::string &fname);
+    // keepRecords and mapFile are turned on and sections/sectionFilter
+    // ignored whatever options says, the whole file is always loaded
+    FBXEditSession(const std::string &fname, FBXReadOptions options);
+
+    FBXDocument &getDocument();
+
+    // writes back to the file the session was opened with
+    void save(const FBXWriteOptions &options = FBXWriteOptions());
+    // the output is written next to fname and renamed over it once
+    // complete, so fname may be the source file
+    void save(const std::string &fname, const FBXWriteOptions &options = FBXWriteOptions());
+private:
+    std::string source;
+    FBXDocument document;
+};
+
+} // namespace fbx
+
+#endif // FBXEDIT_H
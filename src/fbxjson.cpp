@@ -0,0 +1,313 @@
+#include "fbxjson.h"
+#include "fbxdocument.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+using std::string;
+using std::string_view;
+
+namespace fbx {
+
+FBXJsonWriter::FBXJsonWriter(Writer &writer, const FBXJsonOptions &options)
+    :writer(writer),options(options)
+{}
+
+void FBXJsonWriter::put(char c)
+{
+    writer.write((uint8_t) c);
+}
+
+void FBXJsonWriter::put(string_view s)
+{
+    writer.write((const uint8_t*) s.data(), s.size());
+}
+
+void FBXJsonWriter::newline(const string &indent)
+{
+    if(options.compact) return;
+    put('\n');
+    put(indent);
+}
+
+void FBXJsonWriter::write(const FBXDocument &document)
+{
+    bool pretty = !options.compact;
+    put(pretty ? "{\n  \"version\": " : "{\"version\":");
+    number((int64_t) document.getVersion());
+    put(pretty ? ",\n  \"children\": [\n" : ",\"children\":[");
+    bool hasPrev = false;
+    for(auto &node : document.nodes) {
+        if(hasPrev) put(pretty ? ",\n" : ",");
+        write(node, pretty ? "    " : "");
+        hasPrev = true;
+    }
+    put(pretty ? "\n  ]\n}\n" : "]}\n");
+}
+
+void FBXJsonWriter::write(const FBXNode &node, const string &indent)
+{
+    bool pretty = !options.compact;
+    auto &properties = node.getProperties();
+    auto &children = node.getChildren();
+
+    if(pretty) put(indent);
+    put(pretty ? "{ \"name\": " : "{\"name\":");
+    quoted(node.getName());
+    if(!properties.empty()) {
+        put(',');
+        newline(indent);
+        put(pretty ? "  \"properties\": [" : "\"properties\":[");
+        bool hasPrev = false;
+        for(auto &prop : properties) {
+            if(hasPrev) put(',');
+            newline(indent);
+            put(pretty ? "    { \"type\": \"" : "{\"type\":\"");
+            put(prop.getType());
+            put('"');
+            if(prop.is_array() && options.maxArrayElements > 0
+               && prop.getArrayLength() > options.maxArrayElements) {
+                put(pretty ? ", \"length\": " : ",\"length\":");
+                number((int64_t) prop.getArrayLength());
+            }
+            put(pretty ? ", \"value\": " : ",\"value\":");
+            write(prop);
+            put(pretty ? " }" : "}");
+            hasPrev = true;
+        }
+        newline(indent);
+        put(pretty ? "  ]" : "]");
+    }
+    if(!children.empty()) {
+        put(',');
+        newline(indent);
+        put(pretty ? "  \"children\": [\n" : "\"children\":[");
+        string childIndent = pretty ? indent + "    " : "";
+        bool hasPrev = false;
+        for(auto &child : children) {
+            if(hasPrev) put(pretty ? ",\n" : ",");
+            write(child, childIndent);
+            hasPrev = true;
+        }
+        newline(indent);
+        put(pretty ? "  ]" : "]");
+    }
+    newline(indent);
+    put('}');
+}
+
+void FBXJsonWriter::write(const FBXProperty &property)
+{
+    char type = property.getType();
+    const FBXPropertyValue &value = property.value;
+    if(type == 'Y') number((int64_t) value.i16);
+    else if(type == 'C') put(value.boolean ? "true" : "false");
+    else if(type == 'I') number((int64_t) value.i32);
+    else if(type == 'F') number(value.f32);
+    else if(type == 'D') number(value.f64);
+    else if(type == 'L') number(value.i64);
+    else if(type == 'R') {
+        // signed byte values separated by spaces
+        put('"');
+        for(char c : property.raw) {
+            number((int64_t) c);
+            put(' ');
+        }
+        put('"');
+    } else if(type == 'S') {
+        quoted(property.raw.view());
+    } else if(type == 'f') array(property.getFloatArray());
+    else if(type == 'd') array(property.getDoubleArray());
+    else if(type == 'l') array(property.getInt64Array());
+    else if(type == 'i') array(property.getInt32Array());
+    else if(type == 'b') array(property.getBoolArray());
+    else throw std::string("Invalid property");
+}
+
+void FBXJsonWriter::write(const FBXStats &stats)
+{
+    bool pretty = !options.compact;
+    string indent = pretty ? "  " : "";
+    string entryIndent = pretty ? "    " : "";
+    auto member = [&](string_view name, bool first) {
+        if(!first) put(',');
+        newline(indent);
+        key(name);
+    };
+
+    put('{');
+    member("bytes", true);
+    number((int64_t) stats.bytes);
+    member("totalSeconds", false);
+    number(stats.totalSeconds);
+    member("parseSeconds", false);
+    number(stats.parseSeconds);
+    member("decompressSeconds", false);
+    number(stats.decompressSeconds);
+
+    member("arrays", false);
+    put(pretty ? "{ " : "{");
+    key("count");
+    number((int64_t) stats.arrays);
+    put(pretty ? ", " : ",");
+    key("compressed");
+    number((int64_t) stats.compressedArrays);
+    put(pretty ? ", " : ",");
+    key("compressedBytes");
+    number((int64_t) stats.compressedBytes);
+    put(pretty ? ", " : ",");
+    key("inflatedBytes");
+    number((int64_t) stats.inflatedBytes);
+    put(pretty ? ", " : ",");
+    key("uncompressedBytes");
+    number((int64_t) stats.uncompressedBytes);
+    put(pretty ? " }" : "}");
+
+    member("dedup", false);
+    put(pretty ? "{ " : "{");
+    key("arrays");
+    number((int64_t) stats.dedup.arrays);
+    put(pretty ? ", " : ",");
+    key("duplicates");
+    number((int64_t) stats.dedup.duplicates);
+    put(pretty ? ", " : ",");
+    key("duplicateBytes");
+    number((int64_t) stats.dedup.duplicateBytes);
+    put(pretty ? ", " : ",");
+    key("retainedBytes");
+    number((int64_t) stats.dedup.retainedBytes);
+    put(pretty ? " }" : "}");
+
+    member("properties", false);
+    put('[');
+    std::vector<std::pair<char, FBXPropertyStats>> properties(stats.properties.begin(), stats.properties.end());
+    std::stable_sort(properties.begin(), properties.end(), [](const auto &a, const auto &b) {
+        return a.second.bytes > b.second.bytes;
+    });
+    for(size_t i = 0; i < properties.size(); i++) {
+        if(i > 0) put(',');
+        newline(entryIndent);
+        put(pretty ? "{ " : "{");
+        key("type");
+        put('"');
+        put(properties[i].first);
+        put(pretty ? "\", " : "\",");
+        key("count");
+        number((int64_t) properties[i].second.count);
+        put(pretty ? ", " : ",");
+        key("bytes");
+        number((int64_t) properties[i].second.bytes);
+        put(pretty ? " }" : "}");
+    }
+    newline(indent);
+    put(']');
+
+    member("nodes", false);
+    put('[');
+    std::vector<std::pair<std::string, FBXNodeStats>> nodes(stats.nodes.begin(), stats.nodes.end());
+    std::stable_sort(nodes.begin(), nodes.end(), [](const auto &a, const auto &b) {
+        return a.second.bytes > b.second.bytes;
+    });
+    for(size_t i = 0; i < nodes.size(); i++) {
+        if(i > 0) put(',');
+        newline(entryIndent);
+        put(pretty ? "{ " : "{");
+        key("name");
+        quoted(nodes[i].first);
+        put(pretty ? ", " : ",");
+        key("count");
+        number((int64_t) nodes[i].second.count);
+        put(pretty ? ", " : ",");
+        key("bytes");
+        number((int64_t) nodes[i].second.bytes);
+        put(pretty ? " }" : "}");
+    }
+    newline(indent);
+    put(']');
+    newline("");
+    put("}\n");
+}
+
+void FBXJsonWriter::key(string_view name)
+{
+    quoted(name);
+    put(options.compact ? ":" : ": ");
+}
+
+void FBXJsonWriter::quoted(string_view s)
+{
+    static const char hex[] = "0123456789abcdef";
+    put('"');
+    size_t start = 0;
+    for(size_t i = 0; i < s.size(); i++) {
+        uint8_t c = s[i];
+        if(c >= 32 && c <= 126 && c != '"' && c != '\\') continue;
+        put(s.substr(start, i - start));
+        start = i + 1;
+        if(c == '"' || c == '\\') {
+            put('\\');
+            put((char) c);
+        } else {
+            char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+            put(string_view(escaped, sizeof(escaped)));
+        }
+    }
+    put(s.substr(start));
+    put('"');
+}
+
+void FBXJsonWriter::number(int64_t n)
+{
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), n);
+    put(string_view(buffer, result.ptr - buffer));
+}
+
+namespace {
+    // JSON has no NaN or infinities
+    template<typename T>
+    bool nonFinite(T n, string_view &name)
+    {
+        if(std::isnan(n)) name = "\"NaN\"";
+        else if(std::isinf(n)) name = n > 0 ? "\"Infinity\"" : "\"-Infinity\"";
+        else return false;
+        return true;
+    }
+}
+
+void FBXJsonWriter::number(float f)
+{
+    string_view name;
+    if(nonFinite(f, name)) return put(name);
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), f);
+    put(string_view(buffer, result.ptr - buffer));
+}
+
+void FBXJsonWriter::number(double d)
+{
+    string_view name;
+    if(nonFinite(d, name)) return put(name);
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), d);
+    put(string_view(buffer, result.ptr - buffer));
+}
+
+template<typename T>
+void FBXJsonWriter::array(span<const T> elements)
+{
+    std::size_t count = elements.size();
+    if(options.maxArrayElements > 0 && count > options.maxArrayElements) count = options.maxArrayElements;
+    string_view separator = options.compact ? "," : ", ";
+    put('[');
+    for(std::size_t i = 0; i < count; i++) {
+        if(i > 0) put(separator);
+        if constexpr(std::is_same<T, bool>::value) put(elements[i] ? "true" : "false");
+        else if constexpr(std::is_integral<T>::value) number((int64_t) elements[i]);
+        else number(elements[i]);
+    }
+    put(']');
+}
+
+} // namespace fbx
@@ -0,0 +1,45 @@
+#ifndef FBXJSON_H
+#define FBXJSON_H
+
+#include "fbxnode.h"
+
+namespace fbx {
+
+class FBXDocument;
+
+// Streams documents, nodes and properties as JSON into a Writer. Floats are
+// printed with the shortest representation that reads back to the same value
+// (NaN and infinities as the strings "NaN", "Infinity" and "-Infinity").
+class FBXJsonWriter
+{
+public:
+    FBXJsonWriter(Writer &writer, const FBXJsonOptions &options = FBXJsonOptions());
+
+    void write(const FBXDocument &document);
+    // indent is put in front of every line of the node
+    void write(const FBXNode &node, const std::string &indent = "");
+    // only the value, e.g. 1.5, "text" or [1, 2, 3]
+    void write(const FBXProperty &property);
+    // node and property statistics are listed by bytes, largest first
+    void write(const FBXStats &stats);
+    // s as a JSON string, quoted and escaped
+    void quoted(std::string_view s);
+private:
+    void put(char c);
+    void put(std::string_view s);
+    // line break and indentation, nothing in compact mode
+    void newline(const std::string &indent);
+    // "name": in front of a member
+    void key(std::string_view name);
+    void number(std::int64_t n);
+    void number(float f);
+    void number(double d);
+    template<typename T> void array(span<const T> elements);
+
+    Writer &writer;
+    FBXJsonOptions options;
+};
+
+} // namespace fbx
+
+#endif // FBXJSON_H
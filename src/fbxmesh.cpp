@@ -0,0 +1,188 @@
+#include "fbxmesh.h"
+#include "fbxsimd.h"
+
+using std::string;
+using std::string_view;
+using std::int32_t;
+using std::int64_t;
+using std::uint32_t;
+
+namespace fbx {
+
+namespace {
+    const FBXNode *findChild(const FBXNode &node, string_view name)
+    {
+        for(auto &child : node.getChildren()) {
+            if(child.getName() == name) return &child;
+        }
+        return nullptr;
+    }
+
+    const FBXProperty *firstProperty(const FBXNode *node)
+    {
+        if(node == nullptr || node->getProperties().empty()) return nullptr;
+        return &node->getProperties().front();
+    }
+
+    string_view stringValue(const FBXNode &node, string_view child)
+    {
+        const FBXProperty *prop = firstProperty(findChild(node, child));
+        if(prop == nullptr || prop->getType() != 'S') return string_view();
+        return prop->getString();
+    }
+
+    // double or float array as doubles
+    std::vector<double> numbers(const FBXProperty &prop)
+    {
+        if(prop.getType() == 'd') {
+            auto elements = prop.getDoubleArray();
+            return std::vector<double>(elements.begin(), elements.end());
+        } else if(prop.getType() == 'f') {
+            auto elements = prop.getFloatArray();
+            return std::vector<double>(elements.begin(), elements.end());
+        }
+        throw std::string("Expected a floating point array");
+    }
+
+    // values of a LayerElementNormal/UV, one value of components numbers
+    // per corner
+    void expandLayer(const FBXNode &layer, string_view dataName, string_view indexName,
+                     std::size_t components, const FBXMesh &mesh,
+                     const std::vector<uint32_t> &polygonOfCorner, std::vector<double> &out)
+    {
+        const FBXProperty *data = firstProperty(findChild(layer, dataName));
+        if(data == nullptr) return;
+        std::vector<double> values = numbers(*data);
+        std::size_t valueCount = values.size() / components;
+
+        string_view mapping = stringValue(layer, "MappingInformationType");
+        string_view reference = stringValue(layer, "ReferenceInformationType");
+        span<const int32_t> indices;
+        bool indexed = reference == "IndexToDirect" || reference == "Index";
+        if(indexed) {
+            const FBXProperty *index = firstProperty(findChild(layer, indexName));
+            if(index == nullptr) throw std::string("Layer element without ") + string(indexName);
+            indices = index->getInt32Array();
+        }
+
+        std::size_t cornerCount = mesh.corners.size();
+        out.resize(cornerCount * components);
+        for(std::size_t c = 0; c < cornerCount; c++) {
+            std::size_t element;
+            if(mapping == "ByPolygonVertex") element = c;
+            else if(mapping == "ByVertice" || mapping == "ByVertex" || mapping == "ByControlPoint") element = mesh.corners[c];
+            else if(mapping == "ByPolygon") element = polygonOfCorner[c];
+            else if(mapping == "AllSame") element = 0;
+            else throw std::string("Unsupported mapping ") + string(mapping);
+
+            if(indexed) {
+                if(element >= indices.size() || indices[element] < 0) {
+                    throw std::string(dataName) + " index out of range";
+                }
+                element = indices[element];
+            }
+            if(element >= valueCount) throw std::string(dataName) + " out of range";
+            for(std::size_t k = 0; k < components; k++) {
+                out[c * components + k] = values[element * components + k];
+            }
+        }
+    }
+
+    string objectName(const FBXNode &node)
+    {
+        // "Name\x00\x01Class"
+        if(node.getProperties().size() < 2 || node.getProperties()[1].getType() != 'S') return string();
+        string_view full = node.getProperties()[1].getString();
+        return string(full.substr(0, full.find(string_view("\x00\x01", 2))));
+    }
+
+    bool isMesh(const FBXNode &node)
+    {
+        auto &props = node.getProperties();
+        return node.getName() == "Geometry" && props.size() >= 3
+               && props[2].getType() == 'S' && props[2].getString() == "Mesh";
+    }
+}
+
+FBXMesh extractMesh(const FBXNode &geometry)
+{
+    FBXMesh mesh;
+    auto &props = geometry.getProperties();
+    if(!props.empty() && props[0].getType() == 'L') mesh.id = props[0].getInteger();
+    mesh.name = objectName(geometry);
+
+    const FBXProperty *vertices = firstProperty(findChild(geometry, "Vertices"));
+    const FBXProperty *polygons = firstProperty(findChild(geometry, "PolygonVertexIndex"));
+    if(vertices == nullptr || polygons == nullptr) return mesh;
+
+    mesh.positions = numbers(*vertices);
+    std::size_t controlPoints = mesh.positions.size() / 3;
+
+    // -(index + 1) marks the last corner of a polygon
+    span<const int32_t> indices = polygons->getInt32Array();
+    FBXIndexCheck check = checkPolygonIndices(indices, controlPoints);
+    if(check.firstInvalid != indices.size()) {
+        throw std::string("PolygonVertexIndex ") + std::to_string(check.firstInvalid)
+              + " of " + mesh.name + " refers to a missing vertex";
+    }
+
+    mesh.corners.resize(indices.size());
+    mesh.polygonOffsets.reserve(check.polygons + 2);
+    mesh.polygonOffsets.push_back(0);
+    std::vector<uint32_t> polygonOfCorner(indices.size());
+    std::size_t triangleCount = 0;
+    uint32_t start = 0;
+    for(std::size_t c = 0; c < indices.size(); c++) {
+        int32_t v = indices[c];
+        mesh.corners[c] = v ^ (v >> 31);
+        polygonOfCorner[c] = mesh.polygonOffsets.size() - 1;
+        if(v < 0) {
+            uint32_t end = c + 1;
+            if(end - start >= 3) triangleCount += end - start - 2;
+            mesh.polygonOffsets.push_back(end);
+            start = end;
+        }
+    }
+    // a missing end marker on the last polygon closes it anyway
+    if(start != indices.size()) {
+        if(indices.size() - start >= 3) triangleCount += indices.size() - start - 2;
+        mesh.polygonOffsets.push_back(indices.size());
+    }
+
+    mesh.triangles.reserve(triangleCount * 3);
+    for(std::size_t p = 0; p + 1 < mesh.polygonOffsets.size(); p++) {
+        uint32_t first = mesh.polygonOffsets[p];
+        uint32_t end = mesh.polygonOffsets[p + 1];
+        for(uint32_t c = first + 1; c + 1 < end; c++) {
+            mesh.triangles.push_back(first);
+            mesh.triangles.push_back(c);
+            mesh.triangles.push_back(c + 1);
+        }
+    }
+
+    if(const FBXNode *normals = findChild(geometry, "LayerElementNormal")) {
+        expandLayer(*normals, "Normals", "NormalsIndex", 3, mesh, polygonOfCorner, mesh.normals);
+    }
+    if(const FBXNode *uvs = findChild(geometry, "LayerElementUV")) {
+        expandLayer(*uvs, "UV", "UVIndex", 2, mesh, polygonOfCorner, mesh.uvs);
+    }
+    return mesh;
+}
+
+std::vector<FBXMesh> extractMeshes(const FBXDocument &document, unsigned threads)
+{
+    std::vector<const FBXNode*> geometries;
+    for(auto &node : document.nodes) {
+        if(node.getName() != "Objects") continue;
+        for(auto &child : node.getChildren()) {
+            if(isMesh(child)) geometries.push_back(&child);
+        }
+    }
+    std::vector<FBXMesh> meshes(geometries.size());
+    parallelFor(geometries.size(), threads, [&](std::size_t i) {
+        meshes[i] = extractMesh(*geometries[i]);
+    });
+    return meshes;
+}
+
+} // namespace fbx
@@ -0,0 +1,41 @@
+#ifndef FBXMESH_H
+#define FBXMESH_H
+
+#include "fbxdocument.h"
+
+namespace fbx {
+
+// Geometry of a mesh in separate (structure of arrays) buffers. Polygons are
+// made of corners, each corner refers to a control point, normals and uvs are
+// expanded to one value per corner whatever their mapping in the file was.
+struct FBXMesh
+{
+    std::int64_t id = 0;
+    std::string name;
+    // x, y, z per control point (Vertices)
+    std::vector<double> positions;
+    // control point of each corner (PolygonVertexIndex with the polygon end
+    // markers decoded)
+    std::vector<std::uint32_t> corners;
+    // first corner of each polygon followed by the number of corners
+    std::vector<std::uint32_t> polygonOffsets;
+    // x, y, z per corner, empty if the mesh has no normals
+    std::vector<double> normals;
+    // u, v per corner from the first uv set, empty if the mesh has none
+    std::vector<double> uvs;
+    // three corners per triangle, polygons are triangulated as fans
+    std::vector<std::uint32_t> triangles;
+
+    std::size_t polygonCount() const { return polygonOffsets.empty() ? 0 : polygonOffsets.size() - 1; }
+};
+
+// geometry is a Geometry node of class "Mesh", throws if its arrays don't fit
+// together
+FBXMesh extractMesh(const FBXNode &geometry);
+// meshes of all Objects/Geometry nodes in document order, extracted on up to
+// threads threads (0 uses the calling thread only)
+std::vector<FBXMesh> extractMeshes(const FBXDocument &document, unsigned threads = 0);
+
+} // namespace fbx
+
+#endif // FBXMESH_H
@@ -1,11 +1,14 @@
 #include "fbxnode.h"
 
 #include "fbxutil.h"
+#include "fbxjson.h"
+#include <algorithm>
 using std::string;
 using std::cout;
 using std::endl;
 using std::ifstream;
 using std::uint32_t;
+using std::uint64_t;
 using std::uint8_t;
 
 namespace fbx {
@@ -14,43 +17,252 @@ FBXNode::FBXNode()
 {
 }
 
-FBXNode::FBXNode(std::string name):name(name) {}
+namespace {
+    SharedBuffer ownName(const std::string &name)
+    {
+        return SharedBuffer(std::vector<uint8_t>(name.begin(), name.end()));
+    }
+}
 
-uint32_t FBXNode::read(std::ifstream &input, uint32_t start_offset)
-{
-    Reader reader(&input);
-    uint32_t bytes = 0;
+FBXNode::FBXNode(std::string name):name(ownName(name)) {}
+
+FBXNode::FBXNode(const allocator_type &alloc)
+    :children(alloc),properties(alloc)
+{}
+
+FBXNode::FBXNode(std::string name, const allocator_type &alloc)
+    :children(alloc),properties(alloc),name(ownName(name))
+{}
+
+FBXNode::FBXNode(const FBXNode &other, const allocator_type &alloc)
+    :children(other.children, alloc),properties(other.properties, alloc),name(other.name),
+     record(other.record),recordVersion(other.recordVersion)
+{}
 
-    uint32_t endOffset = reader.readUint32();
-    uint32_t numProperties = reader.readUint32();
-    uint32_t propertyListLength = reader.readUint32();
+FBXNode::FBXNode(FBXNode &&other, const allocator_type &alloc)
+    :children(std::move(other.children), alloc),properties(std::move(other.properties), alloc),
+     name(std::move(other.name)),record(std::move(other.record)),recordVersion(other.recordVersion)
+{}
+
+uint32_t FBXNodeHeader::read(Reader &reader, uint32_t version)
+{
+    if(version >= 7500) {
+        endOffset = reader.readUint64();
+        numProperties = reader.readUint64();
+        propertyListLength = reader.readUint64();
+    } else {
+        endOffset = reader.readUint32();
+        numProperties = reader.readUint32();
+        propertyListLength = reader.readUint32();
+    }
     uint8_t nameLength = reader.readUint8();
     name = reader.readString(nameLength);
-    bytes += 13 + nameLength;
+    return FBXNode::headerLength(version) + nameLength;
+}
+
+uint32_t FBXNode::headerLength(uint32_t version)
+{
+    // endOffset, numProperties, propertyListLength and nameLength
+    return version >= 7500 ? 25 : 13;
+}
+
+uint64_t FBXNode::read(std::ifstream &input, uint64_t start_offset, uint32_t version)
+{
+    Reader reader(&input);
+    return read(reader, start_offset, FBXReadOptions(), version);
+}
+
+uint64_t FBXNode::read(Reader &reader, uint64_t start_offset, const FBXReadOptions &options, uint32_t version,
+                      FBXStats *stats)
+{
+    uint64_t position = reader.tell();
+    uint64_t endOffset;
+    uint64_t bytes = readHead(reader, options, version, stats, endOffset);
+
+    while(start_offset + bytes < endOffset) {
+        children.emplace_back();
+        bytes += children.back().read(reader, start_offset + bytes, options, version, stats);
+    }
+    if(options.keepRecords) {
+        record = reader.viewAt(position, bytes);
+        recordVersion = version;
+    }
+    return bytes;
+}
+
+uint64_t FBXNode::readShallow(Reader &reader, uint64_t start_offset, const FBXReadOptions &options,
+                              uint32_t version, FBXStats *stats, std::vector<uint64_t> &childOffsets)
+{
+    uint64_t position = reader.tell();
+    uint64_t endOffset;
+    uint64_t bytes = readHead(reader, options, version, stats, endOffset);
+
+    // only the endOffset of each child is looked at to find the next one
+    uint64_t offset = start_offset + bytes;
+    size_t scanned = childOffsets.size();
+    while(offset < endOffset) {
+        childOffsets.push_back(offset);
+        uint64_t childEnd = version >= 7500 ? reader.readUint64() : reader.readUint32();
+        if(childEnd == 0) childEnd = offset + headerLength(version); // null record
+        else if(childEnd <= offset || childEnd > endOffset) throw std::string("Invalid node endOffset");
+        reader.seek(position + (childEnd - start_offset));
+        offset = childEnd;
+    }
+    children.resize(childOffsets.size() - scanned);
+    bytes = offset - start_offset;
+    if(options.keepRecords) {
+        record = reader.viewAt(position, bytes);
+        recordVersion = version;
+    }
+    return bytes;
+}
+
+uint64_t FBXNode::readHead(Reader &reader, const FBXReadOptions &options, uint32_t version,
+                           FBXStats *stats, uint64_t &endOffset)
+{
+    FBXNodeHeader header;
+    uint64_t bytes = header.read(reader, version);
+    endOffset = header.endOffset;
+    uint64_t numProperties = header.numProperties;
+    uint64_t propertyListLength = header.propertyListLength;
+    // names repeat a lot, share one copy of each through the string pool
+    if(reader.getStringPool()) name = reader.getStringPool()->intern(header.name);
+    else name = ownName(header.name);
 
     //std::cout << "so: " << start_offset
     //          << "\tbytes: " << (endOffset == 0 ? 0 : (endOffset - start_offset))
     //          << "\tnumProp: " << numProperties
     //          << "\tpropListLen: " << propertyListLength
-    //          << "\tnameLen: " << std::to_string(nameLength)
+    //          << "\tnameLen: " << name.size()
     //          << "\tname: " << name << "\n";
 
-    for(uint32_t i = 0; i < numProperties; i++) {
-        addProperty(FBXProperty(input));
+    for(uint64_t i = 0; i < numProperties; i++) {
+        properties.emplace_back(reader, options, stats);
     }
     bytes += propertyListLength;
-
-    while(start_offset + bytes < endOffset) {
-        FBXNode child;
-        bytes += child.read(input, start_offset + bytes);
-        addChild(std::move(child));
+    if(stats && !isNull()) {
+        FBXNodeStats &counts = stats->nodes[std::string(name.view())];
+        counts.count++;
+        counts.bytes += bytes;
     }
     return bytes;
 }
 
-uint32_t FBXNode::write(std::ofstream &output, uint32_t start_offset)
+uint64_t FBXNode::write(std::ofstream &output, uint64_t start_offset, uint32_t version) const
 {
     Writer writer(&output);
+    return write(writer, start_offset, version);
+}
+
+uint64_t FBXNode::write(Writer &writer, uint64_t start_offset, uint32_t version) const
+{
+    // sizes of all subtrees are gathered in one bottom up pass so that every
+    // endOffset is known by the time its header gets written
+    std::vector<SubtreeSize> sizes;
+    collectBytes(sizes, version);
+    size_t index = 0;
+    return write(writer, start_offset, version, sizes, index);
+}
+
+namespace {
+    uint64_t loadLittleEndian(const uint8_t *data, uint32_t length)
+    {
+        uint64_t value = 0;
+        for(uint32_t i = length; i-- > 0;) value = (value << 8) | data[i];
+        return value;
+    }
+}
+
+uint64_t FBXNode::childrenOffset() const
+{
+    uint32_t offsetLength = recordVersion >= 7500 ? 8 : 4;
+    uint32_t length = headerLength(recordVersion);
+    if(record.size() < length) return record.size();
+    const uint8_t *data = record.data();
+    uint64_t offset = length + data[length - 1] + loadLittleEndian(data + 2 * offsetLength, offsetLength);
+    return std::min<uint64_t>(offset, record.size());
+}
+
+uint64_t FBXNode::collectBytes(std::vector<SubtreeSize> &sizes, uint32_t version) const
+{
+    size_t index = sizes.size();
+    sizes.push_back({0, false});
+    // the record is stale if anything below was changed or re-encoded
+    bool unchanged = !record.empty() && recordVersion == version;
+    uint64_t bytes = headerLength(version) + name.size();
+    for(auto &prop : properties) {
+        bytes += prop.getBytes();
+        if(prop.is_array() && !prop.hasOriginalEncoding()) unchanged = false;
+    }
+    // and the children must still be the ones read with it, in their place:
+    // swapping or assigning nodes moves records without marking anything
+    const uint8_t *expected = unchanged ? record.data() + childrenOffset() : nullptr;
+    for(auto &child : children) {
+        size_t childIndex = sizes.size();
+        bytes += child.collectBytes(sizes, version);
+        if(!sizes[childIndex].copyRecord || child.record.data() != expected) {
+            unchanged = false;
+        } else {
+            expected += child.record.size();
+        }
+    }
+    if(unchanged && expected != record.data() + record.size()) unchanged = false;
+    if(unchanged) {
+        sizes.resize(index + 1);
+        sizes[index] = {record.size(), true};
+        return record.size();
+    }
+    sizes[index] = {bytes, false};
+    return bytes;
+}
+
+
+void FBXNode::writeRecord(Writer &writer, uint64_t start_offset) const
+{
+    uint32_t offsetLength = recordVersion >= 7500 ? 8 : 4;
+    uint32_t length = headerLength(recordVersion);
+    const uint8_t *data = record.data();
+    uint64_t origin = loadLittleEndian(data, offsetLength) - record.size();
+    if(origin == start_offset) {
+        writer.write(data, record.size());
+        return;
+    }
+
+    // the record moved, the endOffsets of it and all nodes inside it shift
+    // with it, everything else is copied as is
+    size_t position = 0;
+    while(position < record.size()) {
+        if(record.size() - position < length) throw std::string("Corrupt node record");
+        const uint8_t *header = data + position;
+        uint64_t endOffset = loadLittleEndian(header, offsetLength);
+        uint64_t recordBytes = length;
+        if(endOffset != 0) {
+            uint64_t propertyListLength = loadLittleEndian(header + 2 * offsetLength, offsetLength);
+            recordBytes += header[length - 1] + propertyListLength;
+            if(recordBytes > record.size() - position) throw std::string("Corrupt node record");
+            endOffset = endOffset - origin + start_offset;
+            if(offsetLength == 8) {
+                writer.write(endOffset);
+            } else {
+                checkEndOffset(endOffset, recordVersion);
+                writer.write((uint32_t) endOffset);
+            }
+            writer.write(header + offsetLength, recordBytes - offsetLength);
+        } else {
+            writer.write(header, recordBytes);
+        }
+        position += recordBytes;
+    }
+}
+
+uint64_t FBXNode::write(Writer &writer, uint64_t start_offset, uint32_t version,
+                        const std::vector<SubtreeSize> &sizes, size_t &index) const
+{
+    uint64_t bytes = sizes[index].bytes;
+    if(sizes[index++].copyRecord && !isNull()) {
+        writeRecord(writer, start_offset);
+        return bytes;
+    }
 
     if(isNull()) {
         //std::cout << "so: " << start_offset
@@ -59,74 +271,54 @@ uint32_t FBXNode::write(std::ofstream &output, uint32_t start_offset)
         //          << "\tpropListLen: 0"
         //          << "\tnameLen: 0"
         //          << "\tname: \n";
-        for(int i = 0; i < 13; i++) writer.write((uint8_t) 0);
-        return 13;
+        for(uint32_t i = 0; i < headerLength(version); i++) writer.write((uint8_t) 0);
+        return headerLength(version);
     }
 
-    uint32_t propertyListLength = 0;
-    for(auto prop : properties) propertyListLength += prop.getBytes();
-    uint32_t bytes = 13 + name.length() + propertyListLength;
-    for(auto child : children) bytes += child.getBytes();
-
-    if(bytes != getBytes()) throw std::string("bytes != getBytes()");
-    writer.write(start_offset + bytes); // endOffset
-    writer.write((uint32_t) properties.size()); // numProperties
-    writer.write(propertyListLength); // propertyListLength
-    writer.write((uint8_t) name.length());
-    writer.write(name);
+    uint64_t propertyListLength = 0;
+    for(auto &prop : properties) propertyListLength += prop.getBytes();
+
+    if(version >= 7500) {
+        writer.write(start_offset + bytes); // endOffset
+        writer.write((uint64_t) properties.size()); // numProperties
+        writer.write(propertyListLength); // propertyListLength
+    } else {
+        checkEndOffset(start_offset + bytes, version);
+        writer.write((uint32_t) (start_offset + bytes)); // endOffset
+        writer.write((uint32_t) properties.size()); // numProperties
+        writer.write((uint32_t) propertyListLength); // propertyListLength
+    }
+    writer.write((uint8_t) name.size());
+    writer.write(name.data(), name.size());
 
     //std::cout << "so: " << start_offset
     //          << "\tbytes: " << bytes
     //          << "\tnumProp: " << properties.size()
     //          << "\tpropListLen: " << propertyListLength
-    //          << "\tnameLen: " << name.length()
+    //          << "\tnameLen: " << name.size()
     //          << "\tname: " << name << "\n";
 
-    bytes = 13 + name.length() + propertyListLength;
+    uint64_t written = headerLength(version) + name.size() + propertyListLength;
 
-    for(auto prop : properties) prop.write(output);
-    for(auto child : children) bytes += child.write(output,  start_offset + bytes);
+    for(auto &prop : properties) prop.write(writer);
+    for(auto &child : children) written += child.write(writer, start_offset + written, version, sizes, index);
 
-    return bytes;
+    if(written != bytes) throw std::string("Node size changed while writing");
+    return written;
 }
 
-void FBXNode::print(std::string prefix)
+void FBXNode::print(std::string prefix) const
 {
-    cout << prefix << "{ \"name\": \"" << name << "\"" << (properties.size() + children.size() > 0 ? ",\n" : "\n");
-    if(properties.size() > 0) {
-        cout << prefix << "  \"properties\": [\n";
-        bool hasPrev = false;
-        for(FBXProperty prop : properties) {
-            if(hasPrev) cout << ",\n";
-            cout << prefix << "    { \"type\": \"" << prop.getType() << "\", \"value\": " << prop.to_string() << " }";
-            hasPrev = true;
-        }
-        cout << "\n";
-        cout << prefix << "  ]" << (children.size() > 0 ? ",\n" : "\n");
-
-    }
-
-    if(children.size() > 0) {
-        cout << prefix << "  \"children\": [\n";
-        bool hasPrev = false;
-        for(FBXNode node : children) {
-            if(hasPrev) cout << ",\n";
-            node.print(prefix+"    ");
-            hasPrev = true;
-        }
-        cout << "\n";
-        cout << prefix << "  ]\n";
-    }
-
-    cout << prefix << "}";
-
+    Writer writer(&cout);
+    FBXJsonWriter(writer).write(*this, prefix);
+    writer.flush();
 }
 
-bool FBXNode::isNull()
+bool FBXNode::isNull() const
 {
     return children.size() == 0
             && properties.size() == 0
-            && name.length() == 0;
+            && name.size() == 0;
 }
 
 // primitive values
@@ -137,55 +329,120 @@ void FBXNode::addProperty(float v) { addProperty(FBXProperty(v)); }
 void FBXNode::addProperty(double v) { addProperty(FBXProperty(v)); }
 void FBXNode::addProperty(int64_t v) { addProperty(FBXProperty(v)); }
 // arrays
-void FBXNode::addProperty(const std::vector<bool> v) { addProperty(FBXProperty(v)); }
-void FBXNode::addProperty(const std::vector<int32_t> v) { addProperty(FBXProperty(v)); }
-void FBXNode::addProperty(const std::vector<float> v) { addProperty(FBXProperty(v)); }
-void FBXNode::addProperty(const std::vector<double> v) { addProperty(FBXProperty(v)); }
-void FBXNode::addProperty(const std::vector<int64_t> v) { addProperty(FBXProperty(v)); }
+void FBXNode::addProperty(const std::vector<bool> &v) { addProperty(FBXProperty(v)); }
+void FBXNode::addProperty(const std::vector<int32_t> &v) { addProperty(FBXProperty(v)); }
+void FBXNode::addProperty(const std::vector<float> &v) { addProperty(FBXProperty(v)); }
+void FBXNode::addProperty(const std::vector<double> &v) { addProperty(FBXProperty(v)); }
+void FBXNode::addProperty(const std::vector<int64_t> &v) { addProperty(FBXProperty(v)); }
 // raw / string
-void FBXNode::addProperty(const std::vector<uint8_t> v, uint8_t type) { addProperty(FBXProperty(v, type)); }
-void FBXNode::addProperty(const std::string v) { addProperty(FBXProperty(v)); }
+void FBXNode::addProperty(const std::vector<uint8_t> &v, uint8_t type) { addProperty(FBXProperty(v, type)); }
+void FBXNode::addProperty(const std::string &v) { addProperty(FBXProperty(v)); }
 void FBXNode::addProperty(const char *v) { addProperty(FBXProperty(v)); }
 
-void FBXNode::addProperty(FBXProperty prop) { properties.push_back(prop); }
+void FBXNode::addProperty(FBXProperty prop)
+{
+    markModified();
+    properties.push_back(std::move(prop));
+}
 
 
-void FBXNode::addPropertyNode(const std::string name, int16_t v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, bool v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, int32_t v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, float v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, double v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, int64_t v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, const std::vector<bool> v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, const std::vector<int32_t> v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, const std::vector<float> v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, const std::vector<double> v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, const std::vector<int64_t> v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, const std::vector<uint8_t> v, uint8_t type) { FBXNode n(name); n.addProperty(v, type); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, const std::string v) { FBXNode n(name); n.addProperty(v); addChild(n); }
-void FBXNode::addPropertyNode(const std::string name, const char *v) { FBXNode n(name); n.addProperty(v); addChild(n); }
+void FBXNode::addPropertyNode(const std::string &name, int16_t v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, bool v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, int32_t v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, float v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, double v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, int64_t v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, const std::vector<bool> &v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, const std::vector<int32_t> &v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, const std::vector<float> &v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, const std::vector<double> &v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, const std::vector<int64_t> &v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, const std::vector<uint8_t> &v, uint8_t type) { emplaceChild(name).addProperty(v, type); }
+void FBXNode::addPropertyNode(const std::string &name, const std::string &v) { emplaceChild(name).addProperty(v); }
+void FBXNode::addPropertyNode(const std::string &name, const char *v) { emplaceChild(name).addProperty(v); }
+
+void FBXNode::addChild(FBXNode child)
+{
+    markModified();
+    children.push_back(std::move(child));
+}
 
-void FBXNode::addChild(FBXNode child) { children.push_back(child); }
+FBXNode &FBXNode::emplaceChild(std::string name)
+{
+    markModified();
+    children.emplace_back(std::move(name));
+    return children.back();
+}
 
-uint32_t FBXNode::getBytes() {
-    uint32_t bytes = 13 + name.length();
-    for(auto child : children) {
-        bytes += child.getBytes();
+uint64_t FBXNode::getBytes(uint32_t version) const {
+    uint64_t bytes = headerLength(version) + name.size();
+    for(auto &child : children) {
+        bytes += child.getBytes(version);
     }
-    for(auto prop : properties) {
+    for(auto &prop : properties) {
         bytes += prop.getBytes();
     }
     return bytes;
 }
 
-const std::vector<FBXNode> FBXNode::getChildren()
+void FBXNode::collectArrays(std::vector<FBXProperty*> &out)
+{
+    for(auto &prop : properties) {
+        if(prop.is_array()) out.push_back(&prop);
+    }
+    for(auto &child : children) child.collectArrays(out);
+}
+
+void FBXNode::markModified()
+{
+    record = SharedBuffer();
+}
+
+bool FBXNode::hasRecord() const
+{
+    return !record.empty();
+}
+
+std::pmr::vector<FBXNode> &FBXNode::getChildren()
+{
+    markModified();
+    return children;
+}
+
+const std::pmr::vector<FBXNode> &FBXNode::getChildren() const
 {
     return children;
 }
 
-const std::string FBXNode::getName()
+std::pmr::vector<FBXProperty> &FBXNode::getProperties()
+{
+    markModified();
+    return properties;
+}
+
+const std::pmr::vector<FBXProperty> &FBXNode::getProperties() const
+{
+    return properties;
+}
+
+std::pmr::vector<FBXNode>::iterator FBXNode::begin() { return children.begin(); }
+std::pmr::vector<FBXNode>::iterator FBXNode::end() { return children.end(); }
+std::pmr::vector<FBXNode>::const_iterator FBXNode::begin() const { return children.begin(); }
+std::pmr::vector<FBXNode>::const_iterator FBXNode::end() const { return children.end(); }
+
+FBXNode::allocator_type FBXNode::get_allocator() const
+{
+    return children.get_allocator();
+}
+
+std::string_view FBXNode::getName() const
+{
+    return name.view();
+}
+
+bool FBXNode::hasSameName(const FBXNode &other) const
 {
-    return name;
+    return name == other.name;
 }
 
 } // namespace fbx
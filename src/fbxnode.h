@@ -3,18 +3,58 @@
 
 #include "fbxproperty.h"
 
+#include <memory_resource>
+#include <string_view>
+#include <utility>
+
 namespace fbx {
 
+// header of a node record, a null record (end of a node list) has endOffset 0
+struct FBXNodeHeader
+{
+    std::uint64_t endOffset;
+    std::uint64_t numProperties;
+    std::uint64_t propertyListLength;
+    std::string name;
+
+    // returns the number of bytes read
+    std::uint32_t read(Reader &reader, std::uint32_t version);
+};
+
+// Nodes are allocator aware: children and properties are allocated from the
+// memory resource the node was created with, and children inherit it. Names
+// of nodes read by FBXDocument are shared through its string pool.
 class FBXNode
 {
 public:
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
     FBXNode();
     FBXNode(std::string name);
+    explicit FBXNode(const allocator_type &alloc);
+    FBXNode(std::string name, const allocator_type &alloc);
+    FBXNode(const FBXNode &other) = default;
+    FBXNode(FBXNode &&other) = default;
+    FBXNode(const FBXNode &other, const allocator_type &alloc);
+    FBXNode(FBXNode &&other, const allocator_type &alloc);
+    FBXNode &operator=(const FBXNode &other) = default;
+    FBXNode &operator=(FBXNode &&other) = default;
 
-    std::uint32_t read(std::ifstream &input, uint32_t start_offset);
-    std::uint32_t write(std::ofstream &output, uint32_t start_offset);
-    void print(std::string prefix="");
-    bool isNull();
+    // version selects the node record layout, 7500 and later use 64 bit offsets
+    std::uint64_t read(std::ifstream &input, uint64_t start_offset, uint32_t version = 7400);
+    // stats: if set, the subtree is counted in it
+    std::uint64_t read(Reader &reader, uint64_t start_offset,
+                       const FBXReadOptions &options = FBXReadOptions(), uint32_t version = 7400,
+                       FBXStats *stats = nullptr);
+    // reads the header and properties and only scans the children: the
+    // offsets of their records are appended to childOffsets and as many empty
+    // children added, to be read separately (in parallel with copies of reader)
+    std::uint64_t readShallow(Reader &reader, uint64_t start_offset, const FBXReadOptions &options,
+                              uint32_t version, FBXStats *stats, std::vector<uint64_t> &childOffsets);
+    std::uint64_t write(std::ofstream &output, uint64_t start_offset, uint32_t version = 7400) const;
+    std::uint64_t write(Writer &writer, uint64_t start_offset, uint32_t version = 7400) const;
+    void print(std::string prefix="") const;
+    bool isNull() const;
 
     void addProperty(int16_t);
     void addProperty(bool);
@@ -22,40 +62,101 @@ public:
     void addProperty(float);
     void addProperty(double);
     void addProperty(int64_t);
-    void addProperty(const std::vector<bool>);
-    void addProperty(const std::vector<int32_t>);
-    void addProperty(const std::vector<float>);
-    void addProperty(const std::vector<double>);
-    void addProperty(const std::vector<int64_t>);
-    void addProperty(const std::vector<uint8_t>, uint8_t type);
-    void addProperty(const std::string);
+    void addProperty(const std::vector<bool> &);
+    void addProperty(const std::vector<int32_t> &);
+    void addProperty(const std::vector<float> &);
+    void addProperty(const std::vector<double> &);
+    void addProperty(const std::vector<int64_t> &);
+    void addProperty(const std::vector<uint8_t> &, uint8_t type);
+    void addProperty(const std::string &);
     void addProperty(const char*);
     void addProperty(FBXProperty);
 
-    void addPropertyNode(const std::string name, int16_t);
-    void addPropertyNode(const std::string name, bool);
-    void addPropertyNode(const std::string name, int32_t);
-    void addPropertyNode(const std::string name, float);
-    void addPropertyNode(const std::string name, double);
-    void addPropertyNode(const std::string name, int64_t);
-    void addPropertyNode(const std::string name, const std::vector<bool>);
-    void addPropertyNode(const std::string name, const std::vector<int32_t>);
-    void addPropertyNode(const std::string name, const std::vector<float>);
-    void addPropertyNode(const std::string name, const std::vector<double>);
-    void addPropertyNode(const std::string name, const std::vector<int64_t>);
-    void addPropertyNode(const std::string name, const std::vector<uint8_t>, uint8_t type);
-    void addPropertyNode(const std::string name, const std::string);
-    void addPropertyNode(const std::string name, const char*);
+    // constructs the property in place from FBXProperty constructor arguments
+    template<typename... Args>
+    FBXProperty &emplaceProperty(Args&&... args)
+    {
+        markModified();
+        properties.emplace_back(std::forward<Args>(args)...);
+        return properties.back();
+    }
+
+    void addPropertyNode(const std::string &name, int16_t);
+    void addPropertyNode(const std::string &name, bool);
+    void addPropertyNode(const std::string &name, int32_t);
+    void addPropertyNode(const std::string &name, float);
+    void addPropertyNode(const std::string &name, double);
+    void addPropertyNode(const std::string &name, int64_t);
+    void addPropertyNode(const std::string &name, const std::vector<bool> &);
+    void addPropertyNode(const std::string &name, const std::vector<int32_t> &);
+    void addPropertyNode(const std::string &name, const std::vector<float> &);
+    void addPropertyNode(const std::string &name, const std::vector<double> &);
+    void addPropertyNode(const std::string &name, const std::vector<int64_t> &);
+    void addPropertyNode(const std::string &name, const std::vector<uint8_t> &, uint8_t type);
+    void addPropertyNode(const std::string &name, const std::string &);
+    void addPropertyNode(const std::string &name, const char*);
 
+    // pass temporaries (or std::move) to avoid copying the subtree
     void addChild(FBXNode child);
-    uint32_t getBytes();
+    // appends an empty child and returns it for filling in place
+    FBXNode &emplaceChild(std::string name);
+    uint64_t getBytes(uint32_t version = 7400) const;
 
-    const std::vector<FBXNode> getChildren();
-    const std::string getName();
+    // size of a node record header (without the name) in the given version
+    static uint32_t headerLength(uint32_t version);
+
+    // appends the array properties of this subtree
+    void collectArrays(std::vector<FBXProperty*> &out);
+
+    // Nodes read with FBXReadOptions::keepRecords are written by copying
+    // their record from the file while neither they nor their subtree
+    // changed. add*/emplace* and the non-const getProperties() and
+    // getChildren() call this themselves, read through a const node to keep
+    // the record.
+    void markModified();
+    // true while the node holds its record as read
+    bool hasRecord() const;
+
+    std::pmr::vector<FBXNode> &getChildren();
+    const std::pmr::vector<FBXNode> &getChildren() const;
+    std::pmr::vector<FBXProperty> &getProperties();
+    const std::pmr::vector<FBXProperty> &getProperties() const;
+    std::string_view getName() const;
+    // cheap for interned names, they compare by address
+    bool hasSameName(const FBXNode &other) const;
+    allocator_type get_allocator() const;
+
+    // iterate over children, doesn't mark this node modified: changed
+    // children mark themselves and moved ones no longer sit where the
+    // record of this node has them, so it isn't copied either
+    std::pmr::vector<FBXNode>::iterator begin();
+    std::pmr::vector<FBXNode>::iterator end();
+    std::pmr::vector<FBXNode>::const_iterator begin() const;
+    std::pmr::vector<FBXNode>::const_iterator end() const;
 private:
-    std::vector<FBXNode> children;
-    std::vector<FBXProperty> properties;
-    std::string name;
+    // header and properties, returns their bytes
+    std::uint64_t readHead(Reader &reader, const FBXReadOptions &options, uint32_t version,
+                           FBXStats *stats, std::uint64_t &endOffset);
+
+    // size of a subtree, records that can be copied stand for their
+    // whole subtree
+    struct SubtreeSize {
+        std::uint64_t bytes;
+        bool copyRecord;
+    };
+    // where the records of the children start inside the record
+    std::uint64_t childrenOffset() const;
+    std::uint64_t collectBytes(std::vector<SubtreeSize> &sizes, uint32_t version) const;
+    std::uint64_t write(Writer &writer, uint64_t start_offset, uint32_t version,
+                        const std::vector<SubtreeSize> &sizes, size_t &index) const;
+    void writeRecord(Writer &writer, uint64_t start_offset) const;
+
+    std::pmr::vector<FBXNode> children;
+    std::pmr::vector<FBXProperty> properties;
+    SharedBuffer name;
+    // the node's bytes in the file it was read from (keepRecords)
+    SharedBuffer record;
+    std::uint32_t recordVersion = 0;
 };
 
 } // namespace fbx
@@ -0,0 +1,96 @@
+#ifndef FBXOPTIONS_H
+#define FBXOPTIONS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_set>
+
+namespace fbx {
+
+struct FBXReadOptions
+{
+    // parse straight out of a memory mapping of the file instead of an ifstream
+    bool mapFile = true;
+    // string and raw properties reference the mapping instead of copying it,
+    // the file stays mapped while any of them is alive so don't overwrite it
+    // before the document is gone (needs mapFile)
+    bool zeroCopy = false;
+    // keep zlib compressed arrays compressed until they are first accessed,
+    // the first access inflates under a lock so a lazily loaded document can
+    // still be read from several threads
+    bool lazyDecompression = false;
+    // inflate compressed arrays on this many threads after the structure is
+    // parsed, 0 inflates them one by one while parsing
+    // (ignored with lazyDecompression)
+    unsigned decompressionThreads = 0;
+    // parse the children of top level nodes (Objects, Connections...) on
+    // this many threads, their extents are found by a scan of the headers
+    // first; compressed arrays are then also inflated on as many threads
+    // unless decompressionThreads says otherwise (needs a memory backed
+    // input such as mapFile)
+    unsigned parseThreads = 0;
+    // compressed arrays keep their zlib bytes next to the inflated elements so
+    // they can be written back verbatim (see FBXWriteOptions::passthrough),
+    // costs a copy of the compressed bytes; always done where they are
+    // views into the input anyway (zeroCopy) and for lazyDecompression
+    bool keepEncoded = false;
+    // read the file ahead on a background thread while parsing, without
+    // mapFile in chunks of prefetchChunkSize bytes through a ring of
+    // prefetchChunks buffers, with mapFile the kernel reads the mapping ahead
+    bool prefetch = false;
+    std::size_t prefetchChunkSize = 4 << 20;
+    unsigned prefetchChunks = 4;
+    // build the node name/path index right away instead of on the first lookup
+    bool buildIndex = false;
+    // load only these top level nodes (sections such as "Objects"), the rest
+    // is skipped using their endOffset without being read; empty loads all
+    std::unordered_set<std::string> sections;
+    // same as sections but decided by a predicate, takes precedence
+    std::function<bool(const std::string &name)> sectionFilter;
+    // string properties up to this length are stored once per document in a
+    // string pool, node names are always pooled (0 disables pooling strings)
+    std::uint32_t internMaxLength = 64;
+    // allocate nodes and copied property data from a per document
+    // arena instead of one heap allocation each, all of it is freed together
+    // with the document so nodes must not be kept after it is destroyed
+    bool useArena = false;
+    // gather FBXStats about the file, see FBXDocument::getStats()
+    bool collectStats = false;
+    // properties with identical array payloads share one copy of them, see
+    // FBXDocument::deduplicateArrays() (reported in FBXStats::dedup)
+    bool deduplicateArrays = false;
+    // nodes keep a view of their record in the file and are written by
+    // copying it for as long as they are unchanged (see
+    // FBXNode::markModified), keeps the file mapped like zeroCopy
+    // (needs mapFile)
+    bool keepRecords = false;
+};
+
+struct FBXWriteOptions
+{
+    // zlib compress arrays of at least compressionThreshold bytes (encoding 1)
+    bool compressArrays = false;
+    std::uint32_t compressionThreshold = 128;
+    // zlib level 0-9, -1 is zlib's default
+    int compressionLevel = -1;
+    // compress arrays on this many threads before writing, 0 uses the calling thread
+    unsigned compressionThreads = 0;
+    // arrays still holding the bytes they were read with are written as they
+    // were, unless compressArrays asks to compress one stored uncompressed
+    bool passthrough = true;
+};
+
+struct FBXJsonOptions
+{
+    // everything on one line without indentation
+    bool compact = false;
+    // print at most this many elements of each array, 0 prints all of them,
+    // truncated arrays get a "length" member with their full length
+    std::size_t maxArrayElements = 0;
+};
+
+} // namespace fbx
+
+#endif // FBXOPTIONS_H
@@ -0,0 +1,136 @@
+#include "fbxparser.h"
+#include "fbxnode.h"
+
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+
+namespace fbx {
+
+FBXPropertyHandle::FBXPropertyHandle(Reader &reader, const FBXReadOptions &options)
+    :reader(reader),options(options),arrayLength(0),encoding(0),length(0)
+{
+    offset = reader.tell();
+    type = reader.readUint8();
+    if(type == 'S' || type == 'R') {
+        length = reader.readUint32();
+    } else if(type == 'Y') {
+        length = 2;
+    } else if(type == 'C' || type == 'B') {
+        length = 1;
+    } else if(type == 'I' || type == 'F') {
+        length = 4;
+    } else if(type == 'D' || type == 'L') {
+        length = 8;
+    } else if(type == 'f' || type == 'd' || type == 'l' || type == 'i' || type == 'b') {
+        arrayLength = reader.readUint32();
+        encoding = reader.readUint32();
+        length = reader.readUint32();
+    } else {
+        throw std::string("Unsupported property type ")+std::to_string(type);
+    }
+    end = reader.tell() + length;
+}
+
+char FBXPropertyHandle::getType()
+{
+    return type;
+}
+
+bool FBXPropertyHandle::is_array()
+{
+    return type == 'f' || type == 'd' || type == 'l' || type == 'i' || type == 'b';
+}
+
+uint32_t FBXPropertyHandle::getArrayLength()
+{
+    if(!is_array()) throw std::string("Property is not an array");
+    return arrayLength;
+}
+
+uint32_t FBXPropertyHandle::getEncoding()
+{
+    if(!is_array()) throw std::string("Property is not an array");
+    return encoding;
+}
+
+uint32_t FBXPropertyHandle::getLength()
+{
+    return length;
+}
+
+FBXProperty FBXPropertyHandle::load()
+{
+    reader.seek(offset);
+    return FBXProperty(reader, options);
+}
+
+FBXHandler::~FBXHandler() {}
+bool FBXHandler::beginNode(const std::string &) { return true; }
+void FBXHandler::property(FBXPropertyHandle &) {}
+void FBXHandler::endNode(const std::string &) {}
+
+FBXParser::FBXParser(FBXHandler &handler, const FBXReadOptions &options)
+    :handler(handler),options(options),version(0)
+{}
+
+void FBXParser::parse(string fname)
+{
+    if(options.mapFile) {
+        auto mapping = std::make_shared<const MappedFile>(fname);
+        std::shared_ptr<const void> owner;
+        if(options.zeroCopy) owner = mapping;
+        Reader reader(mapping->data(), mapping->size(), owner);
+        parse(reader);
+        return;
+    }
+
+    std::ifstream file(fname, std::ios::in | std::ios::binary);
+    if(!file.is_open()) throw std::string("Cannot read from file: \"" + fname + "\"");
+    Reader reader(&file);
+    parse(reader);
+}
+
+void FBXParser::parse(Reader &reader)
+{
+    if(!checkMagic(reader)) throw std::string("Not a FBX file");
+    version = reader.readUint32();
+    // newer files may use a record layout this parser doesn't know
+    checkVersion(version);
+    // the top level node list ends with a null record
+    while(parseNode(reader));
+}
+
+uint32_t FBXParser::getVersion()
+{
+    return version;
+}
+
+bool FBXParser::parseNode(Reader &reader)
+{
+    FBXNodeHeader header;
+    header.read(reader, version);
+    const string &name = header.name;
+
+    if(header.endOffset == 0) return false; // null record, ends a list of nodes
+    if(!handler.beginNode(name)) {
+        reader.seek(header.endOffset);
+        return true;
+    }
+
+    uint64_t propertiesEnd = reader.tell() + header.propertyListLength;
+    for(uint64_t i = 0; i < header.numProperties; i++) {
+        FBXPropertyHandle property(reader, options);
+        handler.property(property);
+        reader.seek(property.end);
+    }
+    reader.seek(propertiesEnd);
+
+    while(reader.tell() < header.endOffset) {
+        parseNode(reader);
+    }
+    handler.endNode(name);
+    return true;
+}
+
+} // namespace fbx
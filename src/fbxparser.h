@@ -0,0 +1,70 @@
+#ifndef FBXPARSER_H
+#define FBXPARSER_H
+
+#include "fbxproperty.h"
+
+namespace fbx {
+
+// Property as reported to FBXHandler::property(), its payload is only read
+// when load() is called
+class FBXPropertyHandle
+{
+public:
+    char getType();
+    bool is_array();
+    // arrays only
+    std::uint32_t getArrayLength();
+    std::uint32_t getEncoding();
+    // bytes of payload following the property header
+    std::uint32_t getLength();
+
+    FBXProperty load();
+private:
+    friend class FBXParser;
+    FBXPropertyHandle(Reader &reader, const FBXReadOptions &options);
+
+    Reader &reader;
+    const FBXReadOptions &options;
+    std::uint64_t offset;
+    std::uint64_t end;
+    char type;
+    std::uint32_t arrayLength;
+    std::uint32_t encoding;
+    std::uint32_t length;
+};
+
+// Receives the events of FBXParser, override what you need
+class FBXHandler
+{
+public:
+    virtual ~FBXHandler();
+
+    // returning false skips the node, there are no property, child or
+    // endNode events for it
+    virtual bool beginNode(const std::string &name);
+    virtual void property(FBXPropertyHandle &property);
+    virtual void endNode(const std::string &name);
+};
+
+// Walks a file node by node and reports it to a handler without building the
+// node tree, skipped nodes and properties are passed over using their lengths
+class FBXParser
+{
+public:
+    FBXParser(FBXHandler &handler, const FBXReadOptions &options = FBXReadOptions());
+
+    void parse(std::string fname);
+    void parse(Reader &reader);
+
+    std::uint32_t getVersion();
+private:
+    bool parseNode(Reader &reader);
+
+    FBXHandler &handler;
+    FBXReadOptions options;
+    std::uint32_t version;
+};
+
+} // namespace fbx
+
+#endif // FBXPARSER_H
@@ -1,6 +1,13 @@
 #include "fbxproperty.h"
 #include "fbxutil.h"
+#include "fbxjson.h"
+#include "fbxsimd.h"
+#include <chrono>
 #include <functional>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
 #include <zlib.h>
 
 using std::cout;
@@ -61,69 +68,145 @@ namespace { // helpers for reading properties
         }
     };
 
-    class BufferAutoFree
+    // file data to host order, bools are normalized to 0/1
+    void toHostArray(uint8_t *data, uint32_t arrayLength, char type)
     {
-    public:
-        uint8_t *buffer;
-        BufferAutoFree(uint8_t *buf):buffer(buf) {}
+        if(type == 'b') {
+            normalizeBools(data, arrayLength);
+        } else {
+            convertLittleEndian(data, arrayLength, arrayElementSize(type - ('a'-'A')));
+        }
+    }
 
-        ~BufferAutoFree() {
-            free(buffer);
+    // writable buffer from the arena if there is one, the heap otherwise
+    SharedBuffer allocateBuffer(Arena *arena, uint64_t size, uint8_t **data)
+    {
+        if(arena) return arena->allocateBuffer(size, data);
+        std::vector<uint8_t> bytes(size);
+        *data = bytes.data();
+        return SharedBuffer(std::move(bytes));
+    }
+
+    SharedBuffer inflateArray(const uint8_t *compressedBuffer, uint32_t compressedLength,
+                              uint32_t arrayLength, char type, Arena *arena = nullptr)
+    {
+        uint64_t uncompressedLength = (uint64_t) arrayElementSize(type - ('a'-'A')) * arrayLength;
+        uint8_t *decompressedBuffer;
+        SharedBuffer result = allocateBuffer(arena, uncompressedLength, &decompressedBuffer);
+
+        uLongf destLen = uncompressedLength;
+        uLong srcLen = compressedLength;
+        if(uncompress2(decompressedBuffer, &destLen, compressedBuffer, &srcLen) != Z_OK) {
+            throw std::string("Cannot decompress array property");
         }
-    };
+
+        if(srcLen != compressedLength) throw std::string("compressedLength does not match data");
+        if(destLen != uncompressedLength) throw std::string("uncompressedLength does not match data");
+
+        toHostArray(decompressedBuffer, arrayLength, type);
+        return result;
+    }
+
+    template<typename T>
+    SharedBuffer makeArray(const std::vector<T> &a)
+    {
+        std::vector<uint8_t> bytes(a.size() * sizeof(T));
+        if(!a.empty()) memcpy(bytes.data(), a.data(), bytes.size());
+        return SharedBuffer(std::move(bytes));
+    }
 }
 
 FBXProperty::FBXProperty(std::ifstream &input)
 {
     Reader reader(&input);
+    *this = FBXProperty(reader);
+}
+
+FBXProperty::FBXProperty(Reader &reader, const FBXReadOptions &options, FBXStats *stats)
+{
+    uint64_t start = stats ? reader.tell() : 0;
     type = reader.readUint8();
     // std::cout << "  " << type << "\n";
     if(type == 'S' || type == 'R') {
         uint32_t length = reader.readUint32();
-        for(uint32_t i = 0; i < length; i++){
-            uint8_t v = reader.readUint8();
-            raw.push_back(v);
-        }
+        // short strings such as "KString" or "Compound" repeat a lot
+        if(type == 'S' && options.internMaxLength && length <= options.internMaxLength) raw = reader.readInterned(length);
+        else raw = reader.readBuffer(length);
     } else if(type < 'Z') { // primitive types
         value = readPrimitiveValue(reader, type);
     } else {
-        uint32_t arrayLength = reader.readUint32(); // number of elements in array
+        arrayLength = reader.readUint32(); // number of elements in array
         uint32_t encoding = reader.readUint32(); // 0 .. uncompressed, 1 .. zlib-compressed
         uint32_t compressedLength = reader.readUint32();
-        if(encoding) {
-            uint64_t uncompressedLength = arrayElementSize(type - ('a'-'A')) * arrayLength;
-
-            uint8_t *decompressedBuffer = (uint8_t*) malloc(uncompressedLength);
-            if(decompressedBuffer == NULL) throw std::string("Malloc failed");
-            BufferAutoFree baf(decompressedBuffer);
-
-            uint8_t compressedBuffer[compressedLength];
-            reader.read((char*)compressedBuffer, compressedLength);
-
-            uint64_t destLen = uncompressedLength;
-            uint64_t srcLen = compressedLength;
-            uncompress2(decompressedBuffer, &destLen, compressedBuffer, &srcLen);
-
-            if(srcLen != compressedLength) throw std::string("compressedLength does not match data");
-            if(destLen != uncompressedLength) throw std::string("uncompressedLength does not match data");
-
-            Reader r((char*)decompressedBuffer);
-
-            for(uint32_t i = 0; i < arrayLength; i++) {
-                values.push_back(readPrimitiveValue(r, type - ('a'-'A')));
+        uint32_t elementSize = arrayElementSize(type - ('a'-'A'));
+        if(elementSize == 0) throw std::string("Unsupported property type ")+std::to_string(type);
+        uint64_t uncompressedLength = (uint64_t) elementSize * arrayLength;
+        if(encoding && options.lazyDecompression && compressedLength > 0) {
+            compressed = reader.readBuffer(compressedLength);
+            inflated = false;
+        } else if(encoding && (options.keepEncoded || reader.returnsViews())) {
+            compressed = reader.readBuffer(compressedLength);
+            auto inflateStart = std::chrono::steady_clock::now();
+            raw = inflateArray(compressed.data(), compressedLength, arrayLength, type, reader.getArena().get());
+            if(stats) {
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - inflateStart;
+                stats->decompressSeconds += elapsed.count();
+            }
+        } else if(encoding) {
+            // memory backed readers let us inflate straight from the input
+            const uint8_t *compressedBuffer;
+            std::vector<uint8_t> compressedCopy;
+            if(reader.isMemoryBacked()) {
+                compressedBuffer = (const uint8_t*) reader.readView(compressedLength);
+            } else {
+                compressedCopy.resize(compressedLength);
+                reader.read((char*)compressedCopy.data(), compressedLength);
+                compressedBuffer = compressedCopy.data();
             }
+            auto inflateStart = std::chrono::steady_clock::now();
+            raw = inflateArray(compressedBuffer, compressedLength, arrayLength, type, reader.getArena().get());
+            if(stats) {
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - inflateStart;
+                stats->decompressSeconds += elapsed.count();
+            }
+        } else if(isLittleEndian() && type != 'b') {
+            // file layout is the host layout, reference (zero copy) or copy it as is
+            if(compressedLength != uncompressedLength) throw std::string("Invalid array length");
+            raw = reader.readBuffer(uncompressedLength, elementSize);
         } else {
-            for(uint32_t i = 0; i < arrayLength; i++) {
-                values.push_back(readPrimitiveValue(reader, type - ('a'-'A')));
+            if(compressedLength != uncompressedLength) throw std::string("Invalid array length");
+            uint8_t *buffer;
+            raw = allocateBuffer(reader.getArena().get(), uncompressedLength, &buffer);
+            reader.read((char*)buffer, uncompressedLength);
+            toHostArray(buffer, arrayLength, type);
+        }
+        original = !encoding || !compressed.empty();
+        if(stats) {
+            stats->arrays++;
+            if(encoding) {
+                stats->compressedArrays++;
+                stats->compressedBytes += compressedLength;
+                stats->inflatedBytes += uncompressedLength;
+            } else {
+                stats->uncompressedBytes += uncompressedLength;
             }
         }
     }
+    if(stats) {
+        FBXPropertyStats &counts = stats->properties[type];
+        counts.count++;
+        counts.bytes += reader.tell() - start;
+    }
 }
 
-void FBXProperty::write(std::ofstream &output)
+void FBXProperty::write(std::ofstream &output) const
 {
     Writer writer(&output);
+    write(writer);
+}
 
+void FBXProperty::write(Writer &writer) const
+{
     writer.write(type);
     if(type == 'Y') {
         writer.write(value.i16);
@@ -139,29 +222,29 @@ void FBXProperty::write(std::ofstream &output)
         writer.write(value.i64);
     } else if(type == 'R' || type == 'S') {
         writer.write((uint32_t)raw.size());
-        for(char c : raw) {
-            writer.write((uint8_t)c);
-        }
+        writer.write(raw.data(), raw.size());
+    } else if(!compressed.empty()) {
+        writer.write(getArrayLength()); // arrayLength
+        writer.write((uint32_t) 1); // encoding
+        writer.write((uint32_t) compressed.size()); // compressedLength
+        writer.write(compressed.data(), compressed.size());
     } else {
-        writer.write((uint32_t) values.size()); // arrayLength
-        writer.write((uint32_t) 0); // encoding // TODO: support compression
-        uint32_t compressedLength = 0;
-        if(type == 'f') compressedLength = values.size() * 4;
-        else if(type == 'd') compressedLength = values.size() * 8;
-        else if(type == 'l') compressedLength = values.size() * 8;
-        else if(type == 'i') compressedLength = values.size() * 4;
-        else if(type == 'b') compressedLength = values.size() * 1;
-        else throw std::string("Invalid property");
-        writer.write(compressedLength);
-
-        for(auto e : values) {
-            if(type == 'f') writer.write(e.f32);
-            else if(type == 'd') writer.write(e.f64);
-            else if(type == 'l') writer.write((int64_t)(e.i64));
-            else if(type == 'i') writer.write(e.i32);
-            else if(type == 'b') writer.write((uint8_t)(e.boolean ? 1 : 0));
-            else throw std::string("Invalid property");
+        writer.write(getArrayLength()); // arrayLength
+        writer.write((uint32_t) 0); // encoding
+        writer.write(arrayLength * arrayElementSize(type - ('a'-'A'))); // compressedLength
+
+        if(isLittleEndian()) { // elements are stored in file layout
+            inflate();
+            writer.write(raw.data(), raw.size());
+            return;
         }
+
+        if(type == 'f') for(float e : getFloatArray()) writer.write(e);
+        else if(type == 'd') for(double e : getDoubleArray()) writer.write(e);
+        else if(type == 'l') for(int64_t e : getInt64Array()) writer.write(e);
+        else if(type == 'i') for(int32_t e : getInt32Array()) writer.write(e);
+        else if(type == 'b') for(bool e : getBoolArray()) writer.write((uint8_t)(e ? 1 : 0));
+        else throw std::string("Invalid property");
     }
 }
 
@@ -173,118 +256,48 @@ FBXProperty::FBXProperty(float a) { type = 'F'; value.f32 = a; }
 FBXProperty::FBXProperty(double a) { type = 'D'; value.f64 = a; }
 FBXProperty::FBXProperty(int64_t a) { type = 'L'; value.i64 = a; }
 // arrays
-FBXProperty::FBXProperty(const std::vector<bool> a) : type('b'), values(a.size()) {
-    for(auto el : a) {
-        FBXPropertyValue v;
-        v.boolean = el;
-        values.push_back(v);
-    }
-}
-FBXProperty::FBXProperty(const std::vector<int32_t> a) : type('i'), values(a.size()) {
-    for(auto el : a) {
-        FBXPropertyValue v;
-        v.i32 = el;
-        values.push_back(v);
-    }
-}
-FBXProperty::FBXProperty(const std::vector<float> a) : type('f'), values(a.size()) {
-    for(auto el : a) {
-        FBXPropertyValue v;
-        v.f32 = el;
-        values.push_back(v);
-    }
-}
-FBXProperty::FBXProperty(const std::vector<double> a) : type('d'), values(a.size()) {
-    for(auto el : a) {
-        FBXPropertyValue v;
-        v.f64 = el;
-        values.push_back(v);
-    }
-}
-FBXProperty::FBXProperty(const std::vector<int64_t> a) : type('l'), values(a.size()) {
-    for(auto el : a) {
-        FBXPropertyValue v;
-        v.i64 = el;
-        values.push_back(v);
-    }
+FBXProperty::FBXProperty(const std::vector<bool> &a) : type('b') {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(a.size());
+    for(bool el : a) bytes.push_back(el ? 1 : 0);
+    raw = SharedBuffer(std::move(bytes));
+    arrayLength = a.size();
 }
+FBXProperty::FBXProperty(const std::vector<int32_t> &a) : type('i'), raw(makeArray(a)), arrayLength(a.size()) {}
+FBXProperty::FBXProperty(const std::vector<float> &a) : type('f'), raw(makeArray(a)), arrayLength(a.size()) {}
+FBXProperty::FBXProperty(const std::vector<double> &a) : type('d'), raw(makeArray(a)), arrayLength(a.size()) {}
+FBXProperty::FBXProperty(const std::vector<int64_t> &a) : type('l'), raw(makeArray(a)), arrayLength(a.size()) {}
 // raw / string
-FBXProperty::FBXProperty(const std::vector<uint8_t> a, uint8_t type): raw(a) {
+FBXProperty::FBXProperty(const std::vector<uint8_t> &a, uint8_t type): raw(a) {
     if(type != 'R' && type != 'S') {
         throw std::string("Bad argument to FBXProperty constructor");
     }
     this->type = type;
 }
 // string
-FBXProperty::FBXProperty(const std::string a){
-    for(uint8_t v : a) {
-        raw.push_back(v);
-    }
-    this->type = 'S';
-}
-FBXProperty::FBXProperty(const char *a){
-    for(;*a != 0; a++) {
-        raw.push_back(*a);
-    }
+FBXProperty::FBXProperty(const std::string &a): raw(std::vector<uint8_t>(a.begin(), a.end())) {
     this->type = 'S';
 }
+FBXProperty::FBXProperty(const char *a): FBXProperty(std::string(a)) {}
 
-namespace {
-    char base16Letter(uint8_t n) {
-        n %= 16;
-        if(n <= 9) return n + '0';
-        return n + 'a' - 10;
-    }
-    std::string base16Number(uint8_t n) {
-        return std::string() + base16Letter(n >> 4) + base16Letter(n);
-    }
-}
-
-char FBXProperty::getType()
+char FBXProperty::getType() const
 {
     return type;
 }
 
-string FBXProperty::to_string()
+string FBXProperty::to_string() const
 {
-    if(type == 'Y') return std::to_string(value.i16);
-    else if(type == 'C') return value.boolean ? "true" : "false";
-    else if(type == 'I') return std::to_string(value.i32);
-    else if(type == 'F') return std::to_string(value.f32);
-    else if(type == 'D') return std::to_string(value.f64);
-    else if(type == 'L') return std::to_string(value.i64);
-    else if(type == 'R') {
-        string s("\"");
-        for(char c : raw) {
-            s += std::to_string(c) + " ";
-        }
-        return s + "\"";
-    } else if(type == 'S') {
-        string s("\"");
-        for(uint8_t c : raw) {
-            if(c == '\\') s += "\\\\";
-            else if(c >= 32 && c <= 126) s += c;
-            else s = s + "\\u00" + base16Number(c);
-        }
-        return s + "\"";
-    } else {
-        string s("[");
-        bool hasPrev = false;
-        for(auto e : values) {
-            if(hasPrev) s += ", ";
-            if(type == 'f') s += std::to_string(e.f32);
-            else if(type == 'd') s += std::to_string(e.f64);
-            else if(type == 'l') s += std::to_string(e.i64);
-            else if(type == 'i') s += std::to_string(e.i32);
-            else if(type == 'b') s += (e.boolean ? "true" : "false");
-            hasPrev = true;
-        }
-        return s+"]";
+    std::vector<uint8_t> json;
+    {
+        // most values are a few bytes, don't set up a full sized buffer
+        Writer writer(&json, 64);
+        FBXJsonWriter(writer).write(*this);
+        writer.flush();
     }
-    throw std::string("Invalid property");
+    return string(json.begin(), json.end());
 }
 
-uint32_t FBXProperty::getBytes()
+uint32_t FBXProperty::getBytes() const
 {
     if(type == 'Y') return 2 + 1; // 2 for int16, 1 for type spec
     else if(type == 'C') return 1 + 1;
@@ -294,12 +307,176 @@ uint32_t FBXProperty::getBytes()
     else if(type == 'L') return 8 + 1;
     else if(type == 'R') return raw.size() + 5;
     else if(type == 'S') return raw.size() + 5;
-    else if(type == 'f') return values.size() * 4 + 13;
-    else if(type == 'd') return values.size() * 8 + 13;
-    else if(type == 'l') return values.size() * 8 + 13;
-    else if(type == 'i') return values.size() * 4 + 13;
-    else if(type == 'b') return values.size() * 1 + 13;
+    else if(is_array() && !compressed.empty()) return compressed.size() + 13;
+    else if(is_array()) return arrayLength * arrayElementSize(type - ('a'-'A')) + 13;
     throw std::string("Invalid property");
 }
 
+int64_t FBXProperty::getInteger() const
+{
+    if(type == 'Y') return value.i16;
+    else if(type == 'C') return value.boolean ? 1 : 0;
+    else if(type == 'I') return value.i32;
+    else if(type == 'L') return value.i64;
+    throw std::string("Property is not an integer");
+}
+
+double FBXProperty::getNumber() const
+{
+    if(type == 'F') return value.f32;
+    else if(type == 'D') return value.f64;
+    else if(type == 'Y' || type == 'C' || type == 'I' || type == 'L') return (double) getInteger();
+    throw std::string("Property is not a number");
+}
+
+std::string_view FBXProperty::getString() const
+{
+    if(type != 'S' && type != 'R') throw std::string("Property is not a string");
+    return raw.view();
+}
+
+bool FBXProperty::is_array() const
+{
+    return type == 'f' || type == 'd' || type == 'l' || type == 'i' || type == 'b';
+}
+
+uint32_t FBXProperty::getArrayLength() const
+{
+    if(!is_array()) throw std::string("Property is not an array");
+    return arrayLength;
+}
+
+bool FBXProperty::isCompressed() const
+{
+    return !inflated.value.load(std::memory_order_acquire);
+}
+
+bool FBXProperty::hasOriginalEncoding() const
+{
+    return original;
+}
+
+namespace {
+    // lazily loaded arrays are inflated under one of these, picked by address
+    std::mutex &inflateMutex(const void *prop)
+    {
+        static std::mutex mutexes[64];
+        return mutexes[((uintptr_t) prop / sizeof(void*)) % 64];
+    }
+}
+
+void FBXProperty::inflate() const
+{
+    if(inflated.value.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lock(inflateMutex(this));
+    if(inflated.value.load(std::memory_order_relaxed)) return;
+    raw = inflateArray(compressed.data(), compressed.size(), arrayLength, type);
+    inflated.value.store(true, std::memory_order_release);
+}
+
+void FBXProperty::decompress()
+{
+    inflate();
+    if(!compressed.empty()) original = false;
+    compressed = SharedBuffer();
+}
+
+void FBXProperty::compress(int level)
+{
+    if(!is_array()) throw std::string("Property is not an array");
+    if(!compressed.empty()) return;
+    original = false;
+
+    const uint8_t *source = raw.data();
+    std::vector<uint8_t> littleEndian;
+    if(!isLittleEndian()) {
+        littleEndian.assign(raw.begin(), raw.end());
+        convertLittleEndian(littleEndian.data(), arrayLength, arrayElementSize(type - ('a'-'A')));
+        source = littleEndian.data();
+    }
+
+    uLongf destLen = compressBound(raw.size());
+    std::vector<uint8_t> buffer(destLen);
+    if(compress2(buffer.data(), &destLen, source, raw.size(), level) != Z_OK) {
+        throw std::string("Cannot compress array property");
+    }
+    buffer.resize(destLen);
+    compressed = SharedBuffer(std::move(buffer));
+}
+
+void FBXProperty::encode(const FBXWriteOptions &options)
+{
+    if(!is_array()) return;
+    uint64_t bytes = (uint64_t) arrayLength * arrayElementSize(type - ('a'-'A'));
+    bool compressing = options.compressArrays && bytes >= options.compressionThreshold;
+    if(options.passthrough && original && (!compressed.empty() || !compressing)) return;
+    if(compressing) {
+        compress(options.compressionLevel);
+    } else {
+        decompress();
+    }
+}
+
+FBXDedupStats FBXProperty::deduplicate(const std::vector<FBXProperty*> &arrays, unsigned threads)
+{
+    struct Payload {
+        FBXProperty *prop;
+        SharedBuffer *buffer;
+        bool compressed;
+        std::size_t hash;
+    };
+    FBXDedupStats result;
+    std::vector<Payload> payloads;
+    for(auto *prop : arrays) {
+        if(!prop->is_array()) continue;
+        result.arrays++;
+        if(!prop->isCompressed() && !prop->raw.empty()) payloads.push_back({prop, &prop->raw, false, 0});
+        if(!prop->compressed.empty()) payloads.push_back({prop, &prop->compressed, true, 0});
+    }
+
+    parallelFor(payloads.size(), threads, [&](std::size_t i) {
+        Payload &payload = payloads[i];
+        std::size_t kind = payload.prop->type * 2 + payload.compressed;
+        payload.hash = std::hash<std::string_view>()(payload.buffer->view()) ^ (kind * 0x9e3779b9);
+    });
+
+    // hashes only pick the candidates, the bytes decide
+    std::unordered_map<std::size_t, std::vector<const Payload*>> seen;
+    const FBXProperty *counted = nullptr;
+    for(auto &payload : payloads) {
+        auto &candidates = seen[payload.hash];
+        bool found = false;
+        for(auto *candidate : candidates) {
+            if(candidate->compressed != payload.compressed || candidate->prop->type != payload.prop->type
+               || *candidate->buffer != *payload.buffer) continue;
+            if(candidate->buffer->data() != payload.buffer->data()) {
+                if(payload.buffer->unique()) result.duplicateBytes += payload.buffer->size();
+                else result.retainedBytes += payload.buffer->size();
+                *payload.buffer = *candidate->buffer;
+                if(counted != payload.prop) result.duplicates++;
+                counted = payload.prop;
+            }
+            found = true;
+            break;
+        }
+        if(!found) candidates.push_back(&payload);
+    }
+    return result;
+}
+
+template<typename T>
+span<const T> FBXProperty::getArray(char arrayType) const
+{
+    if(type != arrayType) throw std::string("Property is not an array of type ") + arrayType;
+    inflate();
+    return span<const T>((const T*) raw.data(), raw.size() / sizeof(T));
+}
+
+static_assert(sizeof(bool) == 1, "bool arrays are stored as one byte per element");
+span<const bool> FBXProperty::getBoolArray() const { return getArray<bool>('b'); }
+span<const int32_t> FBXProperty::getInt32Array() const { return getArray<int32_t>('i'); }
+span<const float> FBXProperty::getFloatArray() const { return getArray<float>('f'); }
+span<const double> FBXProperty::getDoubleArray() const { return getArray<double>('d'); }
+span<const int64_t> FBXProperty::getInt64Array() const { return getArray<int64_t>('l'); }
+
 } // namespace fbx
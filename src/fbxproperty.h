@@ -1,10 +1,15 @@
 #ifndef FBXPROPERTY_H
 #define FBXPROPERTY_H
 
+#include <atomic>
 #include <memory>
 #include <iostream>
 #include <vector>
 
+#include "fbxoptions.h"
+#include "fbxstats.h"
+#include "fbxutil.h"
+
 namespace fbx {
 
 // WARNING: (copied from fbxutil.h)
@@ -24,6 +29,8 @@ class FBXProperty
 {
 public:
     FBXProperty(std::ifstream &input);
+    // stats: if set, the property is counted in it
+    FBXProperty(Reader &reader, const FBXReadOptions &options = FBXReadOptions(), FBXStats *stats = nullptr);
     // primitive values
     FBXProperty(int16_t);
     FBXProperty(bool);
@@ -32,28 +39,85 @@ public:
     FBXProperty(double);
     FBXProperty(int64_t);
     // arrays
-    FBXProperty(const std::vector<bool>);
-    FBXProperty(const std::vector<int32_t>);
-    FBXProperty(const std::vector<float>);
-    FBXProperty(const std::vector<double>);
-    FBXProperty(const std::vector<int64_t>);
+    FBXProperty(const std::vector<bool> &);
+    FBXProperty(const std::vector<int32_t> &);
+    FBXProperty(const std::vector<float> &);
+    FBXProperty(const std::vector<double> &);
+    FBXProperty(const std::vector<int64_t> &);
     // raw / string
-    FBXProperty(const std::vector<uint8_t>, uint8_t type);
-    FBXProperty(const std::string);
+    FBXProperty(const std::vector<uint8_t> &, uint8_t type);
+    FBXProperty(const std::string &);
     FBXProperty(const char *);
 
-    void write(std::ofstream &output);
+    void write(std::ofstream &output) const;
+    void write(Writer &writer) const;
+
+    std::string to_string() const;
+    char getType() const;
+
+    bool is_array() const;
+    uint32_t getBytes() const;
 
-    std::string to_string();
-    char getType();
+    // values of single value properties, throw if the type doesn't match
+    // Y, C, I and L
+    int64_t getInteger() const;
+    // any of the above and F, D
+    double getNumber() const;
+    // S and R, the bytes as they are
+    std::string_view getString() const;
 
-    bool is_array();
-    uint32_t getBytes();
+    // typed views of array properties, elements are stored contiguously in
+    // host byte order (bools as one 0/1 byte each), throws if type doesn't match
+    // lazily loaded arrays are decompressed on first access
+    uint32_t getArrayLength() const;
+    span<const bool> getBoolArray() const;
+    span<const int32_t> getInt32Array() const;
+    span<const float> getFloatArray() const;
+    span<const double> getDoubleArray() const;
+    span<const int64_t> getInt64Array() const;
+
+    // true while a lazily loaded array still holds only its compressed bytes
+    bool isCompressed() const;
+    // true while the array holds the encoded bytes it was read with
+    bool hasOriginalEncoding() const;
+    // inflates a lazily loaded array now, its compressed bytes are kept
+    void inflate() const;
+    // inflates the array if needed, it is written uncompressed from then on
+    void decompress();
+    // the array is written zlib compressed from then on, arrays which already
+    // hold compressed bytes keep them
+    void compress(int level);
+    // compresses or decompresses arrays as the options ask for
+    void encode(const FBXWriteOptions &options);
+
+    // makes arrays with the same elements (or, while still compressed, the
+    // same zlib bytes) share one buffer, the first in arrays order is kept.
+    // Payloads are never changed in place, so sharing is copy on write.
+    static FBXDedupStats deduplicate(const std::vector<FBXProperty*> &arrays, unsigned threads = 0);
 private:
+    friend class FBXJsonWriter;
+    template<typename T> span<const T> getArray(char arrayType) const;
+
     uint8_t type;
     FBXPropertyValue value;
-    std::vector<uint8_t> raw;
-    std::vector<FBXPropertyValue> values;
+    // string/raw bytes, or array elements in host byte order
+    // (filled on demand for lazily loaded arrays, hence mutable)
+    mutable SharedBuffer raw;
+    uint32_t arrayLength = 0;
+    // zlib compressed array elements, as read or as they will be written
+    SharedBuffer compressed;
+    // atomic flag that is copied along with the property
+    struct Flag {
+        std::atomic<bool> value;
+        Flag(bool value):value(value) {}
+        Flag(const Flag &other):value(other.value.load()) {}
+        Flag &operator=(const Flag &other) { value = other.value.load(); return *this; }
+    };
+    // false while raw doesn't hold the elements of compressed yet, set under
+    // a lock so that concurrent first accesses inflate once
+    mutable Flag inflated = true;
+    // compressed (or raw if it was stored uncompressed) is what the file had
+    bool original = false;
 };
 
 } // namespace fbx
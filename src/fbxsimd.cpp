@@ -0,0 +1,419 @@
+#include "fbxsimd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FBX_SSE2 1
+#endif
+
+using std::size_t;
+using std::uint8_t;
+using std::int32_t;
+using std::int64_t;
+
+namespace fbx {
+
+namespace {
+    template<typename T>
+    void swapWords(uint8_t *data, size_t count)
+    {
+        // whole word shifts, compilers turn this into bswap and vectorize it
+        for(size_t i = 0; i < count; i++, data += sizeof(T)) {
+            T word, swapped = 0;
+            memcpy(&word, data, sizeof(T));
+            for(size_t b = 0; b < sizeof(T); b++) {
+                swapped |= (T) ((word >> (8 * b)) & 0xff) << (8 * (sizeof(T) - 1 - b));
+            }
+            memcpy(data, &swapped, sizeof(T));
+        }
+    }
+}
+
+void byteSwap(uint8_t *data, size_t count, size_t elementSize)
+{
+    if(elementSize == 2) swapWords<uint16_t>(data, count);
+    else if(elementSize == 4) swapWords<uint32_t>(data, count);
+    else if(elementSize == 8) swapWords<uint64_t>(data, count);
+    else if(elementSize > 1) {
+        for(size_t e = 0; e < count; e++, data += elementSize) {
+            for(size_t a = 0, b = elementSize - 1; a < b; a++, b--) std::swap(data[a], data[b]);
+        }
+    }
+}
+
+void normalizeBools(uint8_t *data, size_t count)
+{
+    size_t i = 0;
+#ifdef FBX_SSE2
+    const __m128i one = _mm_set1_epi8(1);
+    for(; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+        _mm_storeu_si128((__m128i*) (data + i), _mm_and_si128(v, one));
+    }
+#endif
+    for(; i < count; i++) data[i] &= 1;
+}
+
+void packBools(span<const bool> bools, uint8_t *bits)
+{
+    const uint8_t *bytes = (const uint8_t*) bools.data();
+    size_t count = bools.size();
+    size_t i = 0;
+#ifdef FBX_SSE2
+    // bools are 0/1, moving bit 0 up to bit 7 lets movemask collect them
+    for(; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (bytes + i));
+        int mask = _mm_movemask_epi8(_mm_slli_epi16(v, 7));
+        bits[i / 8] = (uint8_t) mask;
+        bits[i / 8 + 1] = (uint8_t) (mask >> 8);
+    }
+#endif
+    for(; i < count; i += 8) {
+        uint8_t byte = 0;
+        for(size_t b = 0; b < 8 && i + b < count; b++) byte |= (bytes[i + b] & 1) << b;
+        bits[i / 8] = byte;
+    }
+}
+
+void unpackBools(const uint8_t *bits, size_t count, bool *bools)
+{
+    for(size_t i = 0; i < count; i++) bools[i] = (bits[i / 8] >> (i % 8)) & 1;
+}
+
+namespace {
+    template<typename T>
+    FBXRange<T> scalarMinMax(const T *data, size_t count, FBXRange<T> range)
+    {
+        for(size_t i = 0; i < count; i++) {
+            T v = data[i];
+            if(v != v) continue; // NaN
+            if(v < range.min) range.min = v;
+            if(v > range.max) range.max = v;
+            range.count++;
+        }
+        return range;
+    }
+
+    template<typename T>
+    FBXRange<T> emptyRange()
+    {
+        if(std::numeric_limits<T>::has_infinity) {
+            return {std::numeric_limits<T>::infinity(), -std::numeric_limits<T>::infinity(), 0};
+        }
+        return {std::numeric_limits<T>::max(), std::numeric_limits<T>::lowest(), 0};
+    }
+}
+
+FBXRange<float> minMax(span<const float> elements)
+{
+    FBXRange<float> range = emptyRange<float>();
+    const float *data = elements.data();
+    size_t count = elements.size();
+    size_t i = 0;
+#ifdef FBX_SSE2
+    if(count >= 4) {
+        // minps/maxps return the second operand if either is NaN, so NaN
+        // elements leave the accumulators alone
+        __m128 lo = _mm_set1_ps(range.min), hi = _mm_set1_ps(range.max);
+        __m128i nans = _mm_setzero_si128();
+        for(; i + 4 <= count; i += 4) {
+            __m128 v = _mm_loadu_ps(data + i);
+            lo = _mm_min_ps(v, lo);
+            hi = _mm_max_ps(v, hi);
+            nans = _mm_sub_epi32(nans, _mm_castps_si128(_mm_cmpunord_ps(v, v)));
+        }
+        float l[4], h[4];
+        int32_t n[4];
+        _mm_storeu_ps(l, lo);
+        _mm_storeu_ps(h, hi);
+        _mm_storeu_si128((__m128i*) n, nans);
+        range.count = i;
+        for(int k = 0; k < 4; k++) {
+            range.min = std::min(range.min, l[k]);
+            range.max = std::max(range.max, h[k]);
+            range.count -= (uint32_t) n[k];
+        }
+    }
+#endif
+    return scalarMinMax(data + i, count - i, range);
+}
+
+FBXRange<double> minMax(span<const double> elements)
+{
+    FBXRange<double> range = emptyRange<double>();
+    const double *data = elements.data();
+    size_t count = elements.size();
+    size_t i = 0;
+#ifdef FBX_SSE2
+    if(count >= 2) {
+        __m128d lo = _mm_set1_pd(range.min), hi = _mm_set1_pd(range.max);
+        __m128i nans = _mm_setzero_si128();
+        for(; i + 2 <= count; i += 2) {
+            __m128d v = _mm_loadu_pd(data + i);
+            lo = _mm_min_pd(v, lo);
+            hi = _mm_max_pd(v, hi);
+            nans = _mm_sub_epi64(nans, _mm_castpd_si128(_mm_cmpunord_pd(v, v)));
+        }
+        double l[2], h[2];
+        int64_t n[2];
+        _mm_storeu_pd(l, lo);
+        _mm_storeu_pd(h, hi);
+        _mm_storeu_si128((__m128i*) n, nans);
+        range.min = std::min(l[0], l[1]);
+        range.max = std::max(h[0], h[1]);
+        range.count = i - n[0] - n[1];
+    }
+#endif
+    return scalarMinMax(data + i, count - i, range);
+}
+
+FBXRange<int32_t> minMax(span<const int32_t> elements)
+{
+    FBXRange<int32_t> range = emptyRange<int32_t>();
+    const int32_t *data = elements.data();
+    size_t count = elements.size();
+    size_t i = 0;
+#ifdef FBX_SSE2
+    if(count >= 4) {
+        // SSE2 has no pminsd/pmaxsd, select through compare masks
+        __m128i lo = _mm_set1_epi32(range.min), hi = _mm_set1_epi32(range.max);
+        for(; i + 4 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+            __m128i less = _mm_cmplt_epi32(v, lo);
+            lo = _mm_or_si128(_mm_and_si128(less, v), _mm_andnot_si128(less, lo));
+            __m128i greater = _mm_cmpgt_epi32(v, hi);
+            hi = _mm_or_si128(_mm_and_si128(greater, v), _mm_andnot_si128(greater, hi));
+        }
+        int32_t l[4], h[4];
+        _mm_storeu_si128((__m128i*) l, lo);
+        _mm_storeu_si128((__m128i*) h, hi);
+        for(int k = 0; k < 4; k++) {
+            range.min = std::min(range.min, l[k]);
+            range.max = std::max(range.max, h[k]);
+        }
+        range.count = i;
+    }
+#endif
+    return scalarMinMax(data + i, count - i, range);
+}
+
+FBXRange<int64_t> minMax(span<const int64_t> elements)
+{
+    return scalarMinMax(elements.data(), elements.size(), emptyRange<int64_t>());
+}
+
+namespace {
+    template<typename T>
+    void scalarBounds(const T *xyz, size_t points, FBXBounds &box)
+    {
+        for(size_t p = 0; p < points; p++) {
+            for(int axis = 0; axis < 3; axis++) {
+                double v = xyz[3 * p + axis];
+                if(v < box.min[axis]) box.min[axis] = v;
+                if(v > box.max[axis]) box.max[axis] = v;
+            }
+        }
+        box.points += points;
+    }
+
+    FBXBounds emptyBounds()
+    {
+        double inf = std::numeric_limits<double>::infinity();
+        return {{inf, inf, inf}, {-inf, -inf, -inf}, 0};
+    }
+}
+
+FBXBounds bounds(span<const float> xyz)
+{
+    FBXBounds box = emptyBounds();
+    const float *data = xyz.data();
+    size_t points = xyz.size() / 3;
+    size_t p = 0;
+#ifdef FBX_SSE2
+    if(points >= 4) {
+        // four points are three registers holding xyzx, yzxy and zxyz
+        float inf = std::numeric_limits<float>::infinity();
+        __m128 lo[3], hi[3];
+        for(int r = 0; r < 3; r++) {
+            lo[r] = _mm_set1_ps(inf);
+            hi[r] = _mm_set1_ps(-inf);
+        }
+        for(; p + 4 <= points; p += 4) {
+            for(int r = 0; r < 3; r++) {
+                __m128 v = _mm_loadu_ps(data + 3 * p + 4 * r);
+                lo[r] = _mm_min_ps(v, lo[r]);
+                hi[r] = _mm_max_ps(v, hi[r]);
+            }
+        }
+        for(int r = 0; r < 3; r++) {
+            float l[4], h[4];
+            _mm_storeu_ps(l, lo[r]);
+            _mm_storeu_ps(h, hi[r]);
+            for(int k = 0; k < 4; k++) {
+                int axis = (4 * r + k) % 3;
+                box.min[axis] = std::min(box.min[axis], (double) l[k]);
+                box.max[axis] = std::max(box.max[axis], (double) h[k]);
+            }
+        }
+        box.points = p;
+    }
+#endif
+    scalarBounds(data + 3 * p, points - p, box);
+    return box;
+}
+
+FBXBounds bounds(span<const double> xyz)
+{
+    FBXBounds box = emptyBounds();
+    const double *data = xyz.data();
+    size_t points = xyz.size() / 3;
+    size_t p = 0;
+#ifdef FBX_SSE2
+    if(points >= 2) {
+        // two points are three registers holding xy, zx and yz
+        double inf = std::numeric_limits<double>::infinity();
+        __m128d lo[3], hi[3];
+        for(int r = 0; r < 3; r++) {
+            lo[r] = _mm_set1_pd(inf);
+            hi[r] = _mm_set1_pd(-inf);
+        }
+        for(; p + 2 <= points; p += 2) {
+            for(int r = 0; r < 3; r++) {
+                __m128d v = _mm_loadu_pd(data + 3 * p + 2 * r);
+                lo[r] = _mm_min_pd(v, lo[r]);
+                hi[r] = _mm_max_pd(v, hi[r]);
+            }
+        }
+        for(int r = 0; r < 3; r++) {
+            double l[2], h[2];
+            _mm_storeu_pd(l, lo[r]);
+            _mm_storeu_pd(h, hi[r]);
+            for(int k = 0; k < 2; k++) {
+                int axis = (2 * r + k) % 3;
+                box.min[axis] = std::min(box.min[axis], l[k]);
+                box.max[axis] = std::max(box.max[axis], h[k]);
+            }
+        }
+        box.points = p;
+    }
+#endif
+    scalarBounds(data + 3 * p, points - p, box);
+    return box;
+}
+
+namespace {
+    template<typename T>
+    void scalarNonFinite(const T *data, size_t begin, size_t end, FBXNonFinite &result)
+    {
+        for(size_t i = begin; i < end; i++) {
+            T v = data[i];
+            if(std::isfinite(v)) continue;
+            if(std::isnan(v)) result.nans++;
+            else result.infinities++;
+            if(i < result.first) result.first = i;
+        }
+    }
+}
+
+FBXNonFinite scanNonFinite(span<const float> elements)
+{
+    const float *data = elements.data();
+    size_t count = elements.size();
+    FBXNonFinite result = {0, 0, count};
+    size_t i = 0;
+#ifdef FBX_SSE2
+    // v - v is NaN exactly for NaN and infinite v, blocks with any of them
+    // are classified element by element
+    const size_t block = 64;
+    for(; i + block <= count; i += block) {
+        __m128 bad = _mm_setzero_ps();
+        for(size_t j = i; j < i + block; j += 4) {
+            __m128 v = _mm_loadu_ps(data + j);
+            __m128 d = _mm_sub_ps(v, v);
+            bad = _mm_or_ps(bad, _mm_cmpunord_ps(d, d));
+        }
+        if(_mm_movemask_ps(bad)) scalarNonFinite(data, i, i + block, result);
+    }
+#endif
+    scalarNonFinite(data, i, count, result);
+    return result;
+}
+
+FBXNonFinite scanNonFinite(span<const double> elements)
+{
+    const double *data = elements.data();
+    size_t count = elements.size();
+    FBXNonFinite result = {0, 0, count};
+    size_t i = 0;
+#ifdef FBX_SSE2
+    const size_t block = 32;
+    for(; i + block <= count; i += block) {
+        __m128d bad = _mm_setzero_pd();
+        for(size_t j = i; j < i + block; j += 2) {
+            __m128d v = _mm_loadu_pd(data + j);
+            __m128d d = _mm_sub_pd(v, v);
+            bad = _mm_or_pd(bad, _mm_cmpunord_pd(d, d));
+        }
+        if(_mm_movemask_pd(bad)) scalarNonFinite(data, i, i + block, result);
+    }
+#endif
+    scalarNonFinite(data, i, count, result);
+    return result;
+}
+
+FBXIndexCheck checkPolygonIndices(span<const int32_t> indices, size_t vertexCount)
+{
+    const int32_t *data = indices.data();
+    size_t count = indices.size();
+    FBXIndexCheck result = {false, 0, -1, count};
+    int32_t maxIndex = -1;
+    size_t i = 0;
+#ifdef FBX_SSE2
+    if(count >= 4) {
+        // v ^ (v >> 31) turns -(index + 1) back into index, the sign masks
+        // (-1 per polygon end) are summed up to count polygons
+        __m128i hi = _mm_set1_epi32(-1);
+        __m128i ends = _mm_setzero_si128();
+        for(; i + 4 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+            __m128i sign = _mm_srai_epi32(v, 31);
+            __m128i index = _mm_xor_si128(v, sign);
+            __m128i greater = _mm_cmpgt_epi32(index, hi);
+            hi = _mm_or_si128(_mm_and_si128(greater, index), _mm_andnot_si128(greater, hi));
+            ends = _mm_sub_epi32(ends, sign);
+        }
+        int32_t h[4], e[4];
+        _mm_storeu_si128((__m128i*) h, hi);
+        _mm_storeu_si128((__m128i*) e, ends);
+        for(int k = 0; k < 4; k++) {
+            maxIndex = std::max(maxIndex, h[k]);
+            result.polygons += (uint32_t) e[k];
+        }
+    }
+#endif
+    for(; i < count; i++) {
+        int32_t v = data[i];
+        int32_t index = v ^ (v >> 31);
+        maxIndex = std::max(maxIndex, index);
+        result.polygons += v < 0;
+    }
+    result.maxIndex = maxIndex;
+
+    if(maxIndex >= 0 && (uint64_t) maxIndex >= vertexCount) {
+        for(size_t j = 0; j < count; j++) {
+            int32_t index = data[j] ^ (data[j] >> 31);
+            if((uint64_t) index >= vertexCount) {
+                result.firstInvalid = j;
+                break;
+            }
+        }
+    }
+    result.valid = result.firstInvalid == count && (count == 0 || data[count - 1] < 0);
+    return result;
+}
+
+} // namespace fbx
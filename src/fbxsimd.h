@@ -0,0 +1,71 @@
+#ifndef FBXSIMD_H
+#define FBXSIMD_H
+
+#include "fbxutil.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace fbx {
+
+// Bulk kernels over array property elements (see FBXProperty::getDoubleArray()
+// and friends). They use SSE2 where available and plain loops elsewhere.
+
+// reverses the bytes of count elements of elementSize (2, 4 or 8) bytes
+void byteSwap(std::uint8_t *data, std::size_t count, std::size_t elementSize);
+// turns the bytes of a file bool array into 0/1 (only the lowest bit counts)
+void normalizeBools(std::uint8_t *data, std::size_t count);
+// bools to bits and back, bit i of the output is bits[i / 8] >> (i % 8),
+// bits holds (count + 7) / 8 bytes
+void packBools(span<const bool> bools, std::uint8_t *bits);
+void unpackBools(const std::uint8_t *bits, std::size_t count, bool *bools);
+
+// smallest and largest element, NaNs are skipped, count is the number of
+// elements that were compared (min > max if there were none)
+template<typename T>
+struct FBXRange {
+    T min;
+    T max;
+    std::size_t count;
+};
+FBXRange<float> minMax(span<const float> elements);
+FBXRange<double> minMax(span<const double> elements);
+FBXRange<std::int32_t> minMax(span<const std::int32_t> elements);
+FBXRange<std::int64_t> minMax(span<const std::int64_t> elements);
+
+// axis aligned bounding box of x, y, z triples such as Vertices, NaNs are
+// skipped, a trailing incomplete triple is ignored
+struct FBXBounds {
+    double min[3];
+    double max[3];
+    std::size_t points;
+};
+FBXBounds bounds(span<const float> xyz);
+FBXBounds bounds(span<const double> xyz);
+
+// NaN and infinite elements, first is the index of the first one or the
+// size of the array if all are finite
+struct FBXNonFinite {
+    std::size_t nans;
+    std::size_t infinities;
+    std::size_t first;
+};
+FBXNonFinite scanNonFinite(span<const float> elements);
+FBXNonFinite scanNonFinite(span<const double> elements);
+
+// checks a PolygonVertexIndex array, where the last index of each polygon
+// is stored as -(index + 1): every index has to be below vertexCount and the
+// array has to end a polygon
+struct FBXIndexCheck {
+    bool valid;
+    std::size_t polygons;
+    // largest referenced vertex, -1 for an empty array
+    std::int64_t maxIndex;
+    // first element referencing a vertex >= vertexCount, or the size
+    std::size_t firstInvalid;
+};
+FBXIndexCheck checkPolygonIndices(span<const std::int32_t> indices, std::size_t vertexCount);
+
+} // namespace fbx
+
+#endif // FBXSIMD_H
@@ -0,0 +1,93 @@
+#ifndef FBXSTATS_H
+#define FBXSTATS_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace fbx {
+
+struct FBXNodeStats
+{
+    std::uint64_t count = 0;
+    // header, name and properties as stored in the file, children excluded
+    std::uint64_t bytes = 0;
+};
+
+struct FBXPropertyStats
+{
+    std::uint64_t count = 0;
+    // type byte and payload as stored in the file
+    std::uint64_t bytes = 0;
+};
+
+// Outcome of sharing identical array payloads between properties, see
+// FBXDocument::deduplicateArrays()
+struct FBXDedupStats
+{
+    // array properties looked at
+    std::uint64_t arrays = 0;
+    // arrays that share their elements or compressed bytes with an earlier one
+    std::uint64_t duplicates = 0;
+    // bytes of those payloads that were freed by sharing
+    std::uint64_t duplicateBytes = 0;
+    // bytes of those payloads whose memory lives on anyway, such as views into
+    // the input (zeroCopy, keepRecords) or arena memory, nothing saved there
+    std::uint64_t retainedBytes = 0;
+};
+
+// What a file is made of and where the time to read it went, collected by
+// FBXDocument::read() with FBXReadOptions::collectStats
+struct FBXStats
+{
+    // file header and node records, the footer isn't read
+    std::uint64_t bytes = 0;
+    std::map<std::string, FBXNodeStats> nodes;
+    // by property type code
+    std::map<char, FBXPropertyStats> properties;
+
+    std::uint64_t arrays = 0;
+    std::uint64_t compressedArrays = 0;
+    // zlib compressed arrays: size in the file and once inflated
+    std::uint64_t compressedBytes = 0;
+    std::uint64_t inflatedBytes = 0;
+    // element bytes of arrays stored without compression
+    std::uint64_t uncompressedBytes = 0;
+
+    // wall clock time of the whole read
+    double totalSeconds = 0;
+    // time spent parsing the structure, inflating excluded
+    double parseSeconds = 0;
+    // time spent in zlib, summed over all threads
+    double decompressSeconds = 0;
+
+    // with FBXReadOptions::deduplicateArrays
+    FBXDedupStats dedup;
+
+    // adds the counts of other, collected over another part of the same file
+    void merge(const FBXStats &other)
+    {
+        bytes += other.bytes;
+        for(auto &node : other.nodes) {
+            nodes[node.first].count += node.second.count;
+            nodes[node.first].bytes += node.second.bytes;
+        }
+        for(auto &property : other.properties) {
+            properties[property.first].count += property.second.count;
+            properties[property.first].bytes += property.second.bytes;
+        }
+        arrays += other.arrays;
+        compressedArrays += other.compressedArrays;
+        compressedBytes += other.compressedBytes;
+        inflatedBytes += other.inflatedBytes;
+        uncompressedBytes += other.uncompressedBytes;
+        decompressSeconds += other.decompressSeconds;
+        dedup.arrays += other.dedup.arrays;
+        dedup.duplicates += other.dedup.duplicates;
+        dedup.duplicateBytes += other.dedup.duplicateBytes;
+    }
+};
+
+} // namespace fbx
+
+#endif // FBXSTATS_H
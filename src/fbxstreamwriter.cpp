@@ -0,0 +1,115 @@
+#include "fbxstreamwriter.h"
+
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+
+namespace fbx {
+
+FBXStreamWriter::FBXStreamWriter(Writer &writer, const FBXWriteOptions &options)
+    :writer(writer),options(options),version(7400),base(0),begun(false)
+{}
+
+void FBXStreamWriter::beginDocument(uint32_t version)
+{
+    if(begun) throw string("Document already begun");
+    checkVersion(version);
+    this->version = version;
+    base = writer.tell();
+    begun = true;
+    writeHeader(writer, version);
+}
+
+uint64_t FBXStreamWriter::offset()
+{
+    return writer.tell() - base;
+}
+
+void FBXStreamWriter::writeNull()
+{
+    for(uint32_t i = 0; i < FBXNode::headerLength(version); i++) writer.write((uint8_t) 0);
+}
+
+void FBXStreamWriter::beginChild()
+{
+    if(!begun) throw string("beginDocument() has to be called first");
+    if(!open.empty()) open.back().hasChildren = true;
+}
+
+void FBXStreamWriter::beginNode(const string &name)
+{
+    if(name.empty()) throw string("Node name must not be empty");
+    if(name.size() > 255) throw string("Node name too long: ") + name;
+    beginChild();
+    open.push_back({offset(), 0, 0, false});
+    // endOffset, numProperties and propertyListLength are patched by endNode()
+    for(uint32_t i = 0; i + 1 < FBXNode::headerLength(version); i++) writer.write((uint8_t) 0);
+    writer.write((uint8_t) name.size());
+    writer.write(name);
+}
+
+void FBXStreamWriter::addProperty(FBXProperty property)
+{
+    if(open.empty()) throw string("Properties need a node");
+    OpenNode &node = open.back();
+    if(node.hasChildren) throw string("Properties must be added before child nodes");
+    if(property.is_array()) property.encode(options);
+    uint64_t before = writer.tell();
+    property.write(writer);
+    node.numProperties++;
+    node.propertyListLength += writer.tell() - before;
+}
+
+void FBXStreamWriter::addNode(FBXNode node)
+{
+    beginChild();
+    std::vector<FBXProperty*> arrays;
+    node.collectArrays(arrays);
+    for(auto *prop : arrays) prop->encode(options);
+    node.write(writer, offset(), version);
+}
+
+void FBXStreamWriter::endNode()
+{
+    if(open.empty()) throw string("No node to end");
+    OpenNode node = open.back();
+    open.pop_back();
+    if(node.hasChildren) writeNull();
+    uint64_t endOffset = offset();
+
+    uint8_t header[24];
+    size_t length;
+    if(version >= 7500) {
+        uint64_t fields[3] = {endOffset, node.numProperties, node.propertyListLength};
+        for(int f = 0; f < 3; f++) {
+            for(int i = 0; i < 8; i++) header[f * 8 + i] = (uint8_t) (fields[f] >> (8 * i));
+        }
+        length = 24;
+    } else {
+        checkEndOffset(endOffset, version);
+        uint64_t fields[3] = {endOffset, node.numProperties, node.propertyListLength};
+        for(int f = 0; f < 3; f++) {
+            for(int i = 0; i < 4; i++) header[f * 4 + i] = (uint8_t) (fields[f] >> (8 * i));
+        }
+        length = 12;
+    }
+    writer.patch(base + node.start, header, length);
+}
+
+void FBXStreamWriter::finish()
+{
+    if(!begun) throw string("beginDocument() has to be called first");
+    if(!open.empty()) throw string("Unfinished node ") + std::to_string(open.size()) + " levels deep";
+    writeNull();
+    writeFooter(writer, version);
+    writer.flush();
+    begun = false;
+}
+
+std::size_t FBXStreamWriter::depth() const
+{
+    return open.size();
+}
+
+} // namespace fbx
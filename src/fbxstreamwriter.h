@@ -0,0 +1,67 @@
+#ifndef FBXSTREAMWRITER_H
+#define FBXSTREAMWRITER_H
+
+#include "fbxnode.h"
+
+namespace fbx {
+
+// Writes a file node by node without building the node tree, for scenes that
+// don't fit in memory. Node headers are written with placeholders and patched
+// once the node ends, so the output must be seekable (files, Writers on a
+// vector) unless the whole document fits in the Writer's buffer.
+//
+//     FBXStreamWriter out(writer);
+//     out.beginDocument();
+//     out.beginNode("Objects");
+//     out.beginNode("Geometry");
+//     out.emplaceProperty((int64_t) 1234);
+//     out.beginNode("Vertices");
+//     out.addProperty(FBXProperty(vertices));
+//     out.endNode();
+//     out.endNode();
+//     out.endNode();
+//     out.finish();
+class FBXStreamWriter
+{
+public:
+    FBXStreamWriter(Writer &writer, const FBXWriteOptions &options = FBXWriteOptions());
+
+    // version selects the node record layout, 7500 and later allow files above 4GB
+    void beginDocument(std::uint32_t version = 7400);
+    void beginNode(const std::string &name);
+    // properties of a node have to be added before its first child
+    void addProperty(FBXProperty property);
+    template<typename... Args>
+    void emplaceProperty(Args&&... args) { addProperty(FBXProperty(std::forward<Args>(args)...)); }
+    // a node that has children gets the terminating null record
+    void endNode();
+    // writes a complete subtree as a child of the current node
+    void addNode(FBXNode node);
+    // ends the node list, writes the footer and flushes the writer
+    void finish();
+
+    // nesting depth of the current node, 0 at top level
+    std::size_t depth() const;
+private:
+    struct OpenNode {
+        std::uint64_t start;
+        std::uint64_t numProperties;
+        std::uint64_t propertyListLength;
+        bool hasChildren;
+    };
+    void beginChild();
+    std::uint64_t offset();
+    void writeNull();
+
+    Writer &writer;
+    FBXWriteOptions options;
+    std::uint32_t version;
+    // writer position of the document start
+    std::uint64_t base;
+    bool begun;
+    std::vector<OpenNode> open;
+};
+
+} // namespace fbx
+
+#endif // FBXSTREAMWRITER_H
@@ -1,14 +1,40 @@
 #include "fbxutil.h"
+#include "fbxsimd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <fstream>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace fbx {
 
-namespace {
-    bool isLittleEndian()
-    {
-        uint16_t number = 0x1;
-        char *numPtr = (char*)&number;
-        return (numPtr[0] == 1);
-    }
+bool isLittleEndian()
+{
+    uint16_t number = 0x1;
+    char *numPtr = (char*)&number;
+    return (numPtr[0] == 1);
+}
+
+void convertLittleEndian(uint8_t *data, std::size_t count, std::size_t elementSize)
+{
+    if(isLittleEndian() || elementSize < 2) return;
+    byteSwap(data, count, elementSize);
 }
 
 uint8_t Reader::readUint8()
@@ -99,10 +125,10 @@ uint64_t Reader::readUint64()
 
 std::string Reader::readString(uint32_t length)
 {
-    char buffer[length + 1];
-    buffer[length] = 0;
-    if(length) read(buffer, length);
-    return std::string(buffer);
+    if(stream == NULL) return std::string(advance(length), length);
+    std::string s(length, '\0');
+    if(length) read(&s[0], length);
+    return s;
 }
 
 float Reader::readFloat()
@@ -139,36 +165,673 @@ double Reader::readDouble()
     return f;
 }
 
-Reader::Reader(std::ifstream *input)
-    :ifstream(input),buffer(NULL),i(0)
+Reader::Reader(std::istream *input)
+    :stream(input),buffer(NULL),i(0),size(0)
 {}
 
 Reader::Reader(char *input)
-    :ifstream(NULL),buffer(input),i(0)
+    :stream(NULL),buffer(input),i(0),size(std::numeric_limits<std::size_t>::max())
+{}
+
+Reader::Reader(const char *input, std::size_t size, std::shared_ptr<const void> owner)
+    :stream(NULL),buffer(input),i(0),size(size),owner(owner)
 {}
 
+const char *Reader::advance(std::size_t length)
+{
+    if(length > size - i) throw std::string("Unexpected end of input");
+    const char *p = buffer + i;
+    i += length;
+    return p;
+}
+
 uint8_t Reader::getc()
 {
-    uint8_t tmp;
-    if(ifstream != NULL) (*ifstream) >> tmp;
-    else tmp = buffer[i++];
-    return tmp;
+    if(stream != NULL) return stream->get();
+    return *advance(1);
+}
+
+void Reader::read(char *s, std::size_t n)
+{
+    if(stream != NULL) {
+        stream->read(s, n);
+    } else if(n) {
+        memcpy(s, advance(n), n);
+    }
+}
+
+SharedBuffer Reader::readBuffer(std::size_t length, std::size_t alignment)
+{
+    if(stream == NULL && owner && (uintptr_t)(buffer + i) % alignment == 0) {
+        return SharedBuffer((const uint8_t*) advance(length), length, owner);
+    }
+    if(arena) {
+        uint8_t *data;
+        SharedBuffer result = arena->allocateBuffer(length, &data);
+        if(length) read((char*) data, length);
+        return result;
+    }
+    std::vector<uint8_t> bytes(length);
+    if(length) read((char*) bytes.data(), length);
+    return SharedBuffer(std::move(bytes));
+}
+
+void Reader::setArena(std::shared_ptr<Arena> arena)
+{
+    this->arena = arena;
+}
+
+const std::shared_ptr<Arena> &Reader::getArena()
+{
+    return arena;
+}
+
+void Reader::setStringPool(std::shared_ptr<StringPool> pool)
+{
+    strings = pool;
+}
+
+const std::shared_ptr<StringPool> &Reader::getStringPool()
+{
+    return strings;
+}
+
+SharedBuffer Reader::readInterned(std::size_t length)
+{
+    if(!strings || (stream == NULL && owner)) return readBuffer(length);
+    if(stream == NULL) return strings->intern(std::string_view(advance(length), length));
+    std::string s = readString(length);
+    return strings->intern(s);
+}
+
+SharedBuffer Reader::viewAt(std::uint64_t position, std::size_t length)
+{
+    if(stream != NULL || !owner) return SharedBuffer();
+    if(position > size || length > size - position) throw std::string("Reading past the end of the input");
+    return SharedBuffer((const uint8_t*) buffer + position, length, owner);
+}
+
+bool Reader::returnsViews()
+{
+    return stream == NULL && owner;
+}
+
+bool Reader::isMemoryBacked()
+{
+    return stream == NULL;
+}
+
+const char *Reader::readView(std::size_t length)
+{
+    if(stream != NULL) throw std::string("readView() needs memory backed Reader");
+    return advance(length);
+}
+
+void parallelFor(std::size_t count, unsigned threads, const std::function<void(std::size_t)> &job)
+{
+    if(threads > count) threads = count;
+    if(threads <= 1) {
+        for(std::size_t i = 0; i < count; i++) job(i);
+        return;
+    }
+
+    // jobs are handed out one by one so uneven sizes balance out
+    std::atomic<std::size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&]() {
+        for(std::size_t i = next++; i < count; i = next++) {
+            try {
+                job(i);
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if(!error) error = std::current_exception();
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned t = 1; t < threads; t++) pool.emplace_back(worker);
+    worker();
+    for(auto &thread : pool) thread.join();
+    if(error) std::rethrow_exception(error);
+}
+
+uint64_t Reader::tell()
+{
+    if(stream != NULL) return stream->tellg();
+    return i;
+}
+
+void Reader::seek(uint64_t position)
+{
+    if(stream != NULL) {
+        stream->clear();
+        stream->seekg(position);
+        if(!*stream) throw std::string("Cannot seek in input");
+    } else {
+        if(position > size) throw std::string("Unexpected end of input");
+        i = position;
+    }
+}
+
+bool checkMagic(Reader &reader)
+{
+    std::string magic("Kaydara FBX Binary  ");
+    for(char c : magic) {
+        if(reader.readUint8() != c) return false;
+    }
+    if(reader.readUint8() != 0x00) return false;
+    if(reader.readUint8() != 0x1A) return false;
+    if(reader.readUint8() != 0x00) return false;
+    return true;
+}
+
+void writeHeader(Writer &writer, uint32_t version)
+{
+    writer.write("Kaydara FBX Binary  ");
+    writer.write((uint8_t) 0);
+    writer.write((uint8_t) 0x1A);
+    writer.write((uint8_t) 0);
+    writer.write(version);
+}
+
+void checkVersion(uint32_t version)
+{
+    uint32_t maxVersion = 7700;
+    if(version > maxVersion) throw "Unsupported FBX version "+std::to_string(version)
+                            + " latest supported version is "+std::to_string(maxVersion);
+}
+
+void checkEndOffset(uint64_t endOffset, uint32_t version)
+{
+    if(version < 7500 && endOffset > std::numeric_limits<uint32_t>::max()) {
+        throw std::string("Output exceeds 4GB, it needs FBX version 7500 or later");
+    }
+}
+
+void writeFooter(Writer &writer, uint32_t version)
+{
+    uint8_t footer[] = {
+        0xfa, 0xbc, 0xab, 0x09,
+        0xd0, 0xc8, 0xd4, 0x66, 0xb1, 0x76, 0xfb, 0x83, 0x1c, 0xf7, 0x26, 0x7e, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf8, 0x5a, 0x8c, 0x6a,
+        0xde, 0xf5, 0xd9, 0x7e, 0xec, 0xe9, 0x0c, 0xe3, 0x75, 0x8f, 0x29, 0x0b
+    };
+    // version goes after the id, four zero bytes and 16 bytes of padding
+    for(int i = 0; i < 4; i++) footer[36 + i] = (uint8_t) (version >> (8 * i));
+    writer.write(footer, sizeof(footer));
+}
+
+SharedBuffer::SharedBuffer()
+    :ptr(NULL),length(0)
+{}
+
+SharedBuffer::SharedBuffer(std::vector<uint8_t> bytes)
+{
+    auto owned = std::make_shared<const std::vector<uint8_t>>(std::move(bytes));
+    ptr = owned->data();
+    length = owned->size();
+    owner = std::move(owned);
+}
+
+SharedBuffer::SharedBuffer(const uint8_t *data, std::size_t size, std::shared_ptr<const void> owner)
+    :owner(owner),ptr(data),length(size)
+{}
+
+const uint8_t *SharedBuffer::data() const { return ptr; }
+std::size_t SharedBuffer::size() const { return length; }
+bool SharedBuffer::empty() const { return length == 0; }
+const uint8_t *SharedBuffer::begin() const { return ptr; }
+const uint8_t *SharedBuffer::end() const { return ptr + length; }
+
+std::string_view SharedBuffer::view() const
+{
+    return std::string_view((const char*) ptr, length);
+}
+
+bool SharedBuffer::unique() const
+{
+    return owner.use_count() == 1;
+}
+
+bool SharedBuffer::operator==(const SharedBuffer &other) const
+{
+    if(length != other.length) return false;
+    return ptr == other.ptr || length == 0 || memcmp(ptr, other.ptr, length) == 0;
+}
+
+bool SharedBuffer::operator!=(const SharedBuffer &other) const
+{
+    return !(*this == other);
+}
+
+SharedBuffer StringPool::intern(std::string_view s)
+{
+    // the low bits pick the bucket inside the shard's set, use higher ones
+    Shard &shard = shards[(std::hash<std::string_view>()(s) >> 16) % shardCount];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.strings.find(s);
+    if(it == shard.strings.end()) {
+        char *copy = (char*) shard.storage.allocate(s.size() ? s.size() : 1, 1);
+        if(!s.empty()) memcpy(copy, s.data(), s.size());
+        it = shard.strings.insert(std::string_view(copy, s.size())).first;
+    }
+    return SharedBuffer((const uint8_t*) it->data(), it->size(), shared_from_this());
+}
+
+std::size_t StringPool::size()
+{
+    std::size_t count = 0;
+    for(auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        count += shard.strings.size();
+    }
+    return count;
+}
+
+SharedBuffer Arena::allocateBuffer(std::size_t size, uint8_t **data)
+{
+    // aligned for any array element type
+    *data = (uint8_t*) allocate(size ? size : 1, alignof(std::max_align_t));
+    return SharedBuffer(*data, size, shared_from_this());
+}
+
+void *Arena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return resource.allocate(bytes, alignment);
+}
+
+void Arena::do_deallocate(void*, std::size_t, std::size_t)
+{
+    // released all at once on destruction
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource &other) const noexcept
+{
+    return this == &other;
+}
+
+#ifdef _WIN32
+// no mmap, fall back to reading the whole file into memory
+MappedFile::MappedFile(const std::string &fname, bool)
+    :address(NULL),length(0)
+{
+    std::ifstream file(fname, std::ios::in | std::ios::binary | std::ios::ate);
+    if(!file.is_open()) throw std::string("Cannot read from file: \"" + fname + "\"");
+    length = file.tellg();
+    address = new char[length];
+    file.seekg(0);
+    file.read(address, length);
+    if(!file) {
+        delete[] address;
+        throw std::string("Cannot read from file: \"" + fname + "\"");
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    delete[] address;
+}
+#else
+MappedFile::MappedFile(const std::string &fname, bool prefetch)
+    :address(NULL),length(0)
+{
+    int fd = open(fname.c_str(), O_RDONLY);
+    if(fd < 0) throw std::string("Cannot read from file: \"" + fname + "\"");
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::string("Cannot stat file: \"" + fname + "\"");
+    }
+    length = st.st_size;
+    if(length > 0) {
+        void *p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p == MAP_FAILED) {
+            close(fd);
+            throw std::string("Cannot map file: \"" + fname + "\"");
+        }
+        address = (char*) p;
+        madvise(p, length, MADV_SEQUENTIAL);
+        if(prefetch) madvise(p, length, MADV_WILLNEED);
+    }
+    close(fd); // the mapping stays valid
+}
+
+MappedFile::~MappedFile()
+{
+    if(address != NULL) munmap(address, length);
+}
+#endif
+
+const char *MappedFile::data() const { return address; }
+std::size_t MappedFile::size() const { return length; }
+
+namespace {
+#ifdef _WIN32
+    int openForReading(const std::string &fname) { return _open(fname.c_str(), _O_RDONLY | _O_BINARY); }
+    std::int64_t readAt(int fd, char *data, std::size_t length, std::uint64_t position)
+    {
+        if(_lseeki64(fd, position, SEEK_SET) < 0) return -1;
+        return _read(fd, data, (unsigned) std::min<std::size_t>(length, 1u << 30));
+    }
+    void closeFile(int fd) { _close(fd); }
+#else
+    int openForReading(const std::string &fname) { return open(fname.c_str(), O_RDONLY); }
+    std::int64_t readAt(int fd, char *data, std::size_t length, std::uint64_t position)
+    {
+        ssize_t n;
+        do {
+            n = pread(fd, data, length, position);
+        } while(n < 0 && errno == EINTR);
+        return n;
+    }
+    void closeFile(int fd) { close(fd); }
+#endif
+}
+
+PrefetchBuffer::PrefetchBuffer(const std::string &fname, std::size_t chunkSize, unsigned chunks)
+    :chunkSize(std::max<std::size_t>(chunkSize, 4096)),ring(std::max(chunks, 2u))
+{
+    fd = openForReading(fname);
+    if(fd < 0) throw std::string("Cannot read from file: \"" + fname + "\"");
+#ifdef _WIN32
+    std::int64_t end = _lseeki64(fd, 0, SEEK_END);
+#else
+    std::int64_t end = lseek(fd, 0, SEEK_END);
+#endif
+    if(end < 0) {
+        closeFile(fd);
+        throw std::string("Cannot stat file: \"" + fname + "\"");
+    }
+    fileSize = end;
+#if !defined(_WIN32) && defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    for(auto &chunk : ring) chunk.data.resize(this->chunkSize);
+    thread = std::thread(&PrefetchBuffer::run, this);
+}
+
+PrefetchBuffer::~PrefetchBuffer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    thread.join();
+    closeFile(fd);
+}
+
+void PrefetchBuffer::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        changed.wait(lock, [&]() {
+            return stopping || (error.empty() && readPosition < fileSize && produced - consumed < ring.size());
+        });
+        if(stopping) return;
+
+        std::uint64_t started = generation;
+        std::uint64_t position = readPosition;
+        Chunk &chunk = ring[produced % ring.size()];
+        std::size_t length = std::min<std::uint64_t>(chunkSize, fileSize - position);
+        lock.unlock();
+
+        // the parser doesn't touch this slot until it's marked produced
+        std::size_t filled = 0;
+        int failed = 0;
+        while(filled < length) {
+            std::int64_t n = readAt(fd, chunk.data.data() + filled, length - filled, position + filled);
+            if(n < 0) failed = errno;
+            if(n <= 0) break;
+            filled += n;
+        }
+
+        lock.lock();
+        if(started != generation) continue;
+        if(failed) {
+            error = "Cannot read from file: " + std::string(strerror(failed));
+        } else {
+            // a file that shrank ends early
+            if(filled < length) fileSize = position + filled;
+            chunk.length = filled;
+            chunk.position = position;
+            readPosition = position + filled;
+            if(filled) produced++;
+        }
+        changed.notify_all();
+    }
+}
+
+bool PrefetchBuffer::next()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if(holding) {
+        base += egptr() - eback();
+        consumed++;
+        holding = false;
+        setg(NULL, NULL, NULL);
+        changed.notify_all();
+    }
+    changed.wait(lock, [&]() {
+        return produced > consumed || !error.empty() || readPosition >= fileSize;
+    });
+    if(produced == consumed) {
+        if(!error.empty()) throw error;
+        return false;
+    }
+    Chunk &chunk = ring[consumed % ring.size()];
+    holding = true;
+    base = chunk.position;
+    setg(chunk.data.data(), chunk.data.data(), chunk.data.data() + chunk.length);
+    return true;
+}
+
+void PrefetchBuffer::restart(std::uint64_t position)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+        produced = consumed = 0;
+        readPosition = position;
+        error.clear();
+    }
+    changed.notify_all();
+    holding = false;
+    base = position;
+    setg(NULL, NULL, NULL);
+}
+
+PrefetchBuffer::int_type PrefetchBuffer::underflow()
+{
+    if(gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    if(!next()) return traits_type::eof();
+    return traits_type::to_int_type(*gptr());
+}
+
+PrefetchBuffer::pos_type PrefetchBuffer::seekoff(off_type offset, std::ios_base::seekdir dir,
+                                                 std::ios_base::openmode mode)
+{
+    std::uint64_t current = base + (gptr() - eback());
+    if(dir == std::ios_base::cur && offset == 0) return pos_type(current);
+    off_type target = offset;
+    if(dir == std::ios_base::cur) target += current;
+    else if(dir == std::ios_base::end) target += fileSize;
+    if(target < 0) return pos_type(off_type(-1));
+    return seekpos(pos_type(target), mode);
+}
+
+PrefetchBuffer::pos_type PrefetchBuffer::seekpos(pos_type position, std::ios_base::openmode)
+{
+    std::uint64_t target = (off_type) position;
+    if(target > fileSize) return pos_type(off_type(-1));
+    if(target >= base && target - base <= (std::uint64_t) (egptr() - eback())) {
+        setg(eback(), eback() + (target - base), egptr());
+        return position;
+    }
+    // skip forward through what was read ahead already
+    bool ahead;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ahead = target > base && target < readPosition;
+    }
+    while(ahead && next()) {
+        if(target - base < (std::uint64_t) (egptr() - eback())) {
+            setg(eback(), eback() + (target - base), egptr());
+            return position;
+        }
+    }
+    restart(target);
+    return position;
+}
+
+namespace {
+    const std::size_t writerBufferSize = 1 << 20;
+}
+
+Writer::Writer(std::ostream *output)
+    :ostream(output),vector(NULL),fd(-1),buffer(writerBufferSize),used(0),drained(0),origin(0)
+{
+    std::streamoff position = output->tellp();
+    if(position > 0) origin = position;
+}
+
+Writer::Writer(std::vector<uint8_t> *output)
+    :Writer(output, writerBufferSize)
+{}
+
+Writer::Writer(std::vector<uint8_t> *output, std::size_t bufferSize)
+    :ostream(NULL),vector(output),fd(-1),buffer(std::max<std::size_t>(bufferSize, 16)),used(0),drained(0),
+     origin(output->size())
+{}
+
+Writer::Writer(int fd)
+    :ostream(NULL),vector(NULL),fd(fd),buffer(writerBufferSize),used(0),drained(0),origin(0)
+{
+#ifdef _WIN32
+    int64_t position = ::_lseeki64(fd, 0, SEEK_CUR);
+#else
+    off_t position = ::lseek(fd, 0, SEEK_CUR);
+#endif
+    if(position > 0) origin = position;
+}
+
+Writer::~Writer()
+{
+    try {
+        flush();
+    } catch(std::string&) {
+        // can't report it from here
+    }
+}
+
+void Writer::flush()
+{
+    std::size_t length = used;
+    used = 0;
+    drain(buffer.data(), length);
+    if(ostream != NULL) ostream->flush();
+}
+
+uint64_t Writer::tell()
+{
+    return drained + used;
 }
 
-void Reader::read(char *s, uint32_t n)
+void Writer::patch(uint64_t position, const uint8_t *data, std::size_t length)
 {
-    if(ifstream != NULL) {
-        ifstream->read(s, n);
-    } else for(uint32_t a = 0; a < n; a++) {
-        s[a] = buffer[i++];
+    if(position + length > tell()) throw std::string("Cannot patch bytes that were not written yet");
+    // the part still in the buffer is patched in place
+    if(position + length > drained) {
+        std::size_t skip = position < drained ? drained - position : 0;
+        memcpy(buffer.data() + (position + skip - drained), data + skip, length - skip);
+        length = skip;
     }
+    if(length > 0) patchSink(position, data, length);
 }
 
-Writer::Writer(std::ofstream *output):ofstream(output){}
+void Writer::patchSink(uint64_t position, const uint8_t *data, std::size_t length)
+{
+    uint64_t at = origin + position;
+    if(ostream != NULL) {
+        std::streampos end = ostream->tellp();
+        if(end < 0 || !ostream->seekp(at)) throw std::string("Cannot seek in output stream");
+        ostream->write((const char*) data, length);
+        ostream->seekp(end);
+        if(!*ostream) throw std::string("Cannot write to output stream");
+    } else if(vector != NULL) {
+        memcpy(vector->data() + at, data, length);
+    } else {
+        while(length > 0) {
+#ifdef _WIN32
+            int64_t end = ::_lseeki64(fd, 0, SEEK_CUR);
+            if(end < 0 || ::_lseeki64(fd, at, SEEK_SET) < 0) throw std::string("Cannot seek in file descriptor");
+            int n = ::_write(fd, data, length);
+            ::_lseeki64(fd, end, SEEK_SET);
+#else
+            ssize_t n = ::pwrite(fd, data, length, at);
+#endif
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) throw std::string("Cannot write to file descriptor");
+            data += n;
+            at += n;
+            length -= n;
+        }
+    }
+}
+
+void Writer::drain(const uint8_t *data, std::size_t length)
+{
+    if(length == 0) return;
+    drained += length;
+    if(ostream != NULL) {
+        ostream->write((const char*) data, length);
+        if(!*ostream) throw std::string("Cannot write to output stream");
+    } else if(vector != NULL) {
+        vector->insert(vector->end(), data, data + length);
+    } else {
+        while(length > 0) {
+#ifdef _WIN32
+            int n = ::_write(fd, data, length);
+#else
+            ssize_t n = ::write(fd, data, length);
+#endif
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) throw std::string("Cannot write to file descriptor");
+            data += n;
+            length -= n;
+        }
+    }
+}
 
 void Writer::putc(uint8_t c)
 {
-    (*ofstream) << c;
+    if(used == buffer.size()) flush();
+    buffer[used++] = c;
+}
+
+void Writer::write(const uint8_t *data, std::size_t length)
+{
+    if(length > buffer.size() - used) {
+        flush();
+        if(length >= buffer.size()) {
+            drain(data, length);
+            return;
+        }
+    }
+    if(length) memcpy(buffer.data() + used, data, length);
+    used += length;
 }
 
 void Writer::write(std::uint8_t a)
@@ -236,20 +899,16 @@ void Writer::write(std::int64_t _a)
     putc(a >> 56);
 }
 
-void Writer::write(std::string a)
+void Writer::write(std::string_view a)
 {
-    for(char c : a) {
-        putc(c);
-    }
+    write((const uint8_t*) a.data(), a.size());
 }
 
 void Writer::write(float a)
 {
     char *c = (char *)(&a);
     if(isLittleEndian()) {
-        for(int i = 0; i < 4; i++) {
-            putc(c[i]);
-        }
+        write((const uint8_t*) c, 4);
     } else {
         for(int i = 3; i >= 0; i--) {
             putc(c[i]);
@@ -261,9 +920,7 @@ void Writer::write(double a)
 {
     char *c = (char *)(&a);
     if(isLittleEndian()) {
-        for(int i = 0; i < 8; i++) {
-            putc(c[i]);
-        }
+        write((const uint8_t*) c, 8);
     } else {
         for(int i = 7; i >= 0; i--) {
             putc(c[i]);
@@ -1,22 +1,191 @@
 #ifndef FBXUTIL_H
 #define FBXUTIL_H
 
+#include <condition_variable>
 #include <cstdint>
+#include <cstddef>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <iostream>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 namespace fbx {
+    bool isLittleEndian();
+
+    // swaps bytes of count elements of elementSize bytes between little endian
+    // (file order) and host order, does nothing on little endian hosts
+    void convertLittleEndian(std::uint8_t *data, std::size_t count, std::size_t elementSize);
+
+    // runs job(0) .. job(count - 1) on up to threads threads, the calling thread
+    // included, and rethrows the first exception after all of them finished
+    void parallelFor(std::size_t count, unsigned threads, const std::function<void(std::size_t)> &job);
+
+    // minimal stand-in for C++20 std::span
+    template<typename T>
+    class span {
+    public:
+        span():ptr(nullptr),length(0) {}
+        span(T *data, std::size_t size):ptr(data),length(size) {}
+
+        T *data() const { return ptr; }
+        std::size_t size() const { return length; }
+        bool empty() const { return length == 0; }
+        T *begin() const { return ptr; }
+        T *end() const { return ptr + length; }
+        T &operator[](std::size_t i) const { return ptr[i]; }
+    private:
+        T *ptr;
+        std::size_t length;
+    };
+
+    // Immutable, reference counted range of bytes. It either owns its bytes or
+    // points into a buffer (e.g. a memory mapped file) that is kept alive by owner.
+    // Copies share the same bytes.
+    class SharedBuffer {
+    public:
+        SharedBuffer();
+        SharedBuffer(std::vector<std::uint8_t> bytes);
+        SharedBuffer(const std::uint8_t *data, std::size_t size, std::shared_ptr<const void> owner);
+
+        const std::uint8_t *data() const;
+        std::size_t size() const;
+        bool empty() const;
+        const std::uint8_t *begin() const;
+        const std::uint8_t *end() const;
+        std::string_view view() const;
+        // true if nothing else keeps the memory alive, dropping this buffer
+        // frees it (not so for views into a mapped file or arena memory)
+        bool unique() const;
+
+        // same bytes, interned buffers of one pool compare by pointer only
+        bool operator==(const SharedBuffer &other) const;
+        bool operator!=(const SharedBuffer &other) const;
+    private:
+        std::shared_ptr<const void> owner;
+        const std::uint8_t *ptr;
+        std::size_t length;
+    };
+
+    // Bump allocator whose memory is only released, all at once, when it is
+    // destroyed. Usable as a pmr memory resource from several threads.
+    // Buffers allocated by allocateBuffer() keep it alive.
+    class Arena : public std::pmr::memory_resource, public std::enable_shared_from_this<Arena> {
+    public:
+        // writable buffer of size bytes, data receives its address
+        SharedBuffer allocateBuffer(std::size_t size, std::uint8_t **data);
+    private:
+        void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+        void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+        std::mutex mutex;
+        std::pmr::monotonic_buffer_resource resource;
+    };
+
+    // Stores each distinct string once, interning equal strings returns buffers
+    // with the same address. Thread safe, buffers keep the pool alive.
+    class StringPool : public std::enable_shared_from_this<StringPool> {
+    public:
+        SharedBuffer intern(std::string_view s);
+        // number of distinct strings
+        std::size_t size();
+    private:
+        // strings are spread over shards by hash, each with its own lock, so
+        // that threads parsing in parallel rarely wait for each other
+        struct Shard {
+            std::mutex mutex;
+            std::pmr::monotonic_buffer_resource storage;
+            std::unordered_set<std::string_view> strings;
+        };
+        static const std::size_t shardCount = 32;
+        Shard shards[shardCount];
+    };
+
+    // Read-only memory mapping of a whole file
+    class MappedFile {
+    public:
+        // prefetch: ask the kernel to read the whole file ahead
+        MappedFile(const std::string &fname, bool prefetch = false);
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile &operator=(const MappedFile&) = delete;
+
+        const char *data() const;
+        std::size_t size() const;
+    private:
+        char *address;
+        std::size_t length;
+    };
+
+    // Stream buffer that reads a file on a background thread in chunks of
+    // chunkSize bytes into a ring of chunks buffers, so that parsing overlaps
+    // with the I/O. Seeks into data already read ahead skip to it, other
+    // seeks restart the read ahead at the new position. Read errors are
+    // thrown from the stream (they need exceptions(std::ios::badbit)).
+    class PrefetchBuffer : public std::streambuf {
+    public:
+        PrefetchBuffer(const std::string &fname, std::size_t chunkSize = 4 << 20, unsigned chunks = 4);
+        ~PrefetchBuffer();
+        PrefetchBuffer(const PrefetchBuffer&) = delete;
+        PrefetchBuffer &operator=(const PrefetchBuffer&) = delete;
+    protected:
+        int_type underflow() override;
+        pos_type seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode mode) override;
+        pos_type seekpos(pos_type position, std::ios_base::openmode mode) override;
+    private:
+        struct Chunk {
+            std::vector<char> data;
+            std::size_t length = 0;
+            std::uint64_t position = 0;
+        };
+        void run();
+        // releases the current chunk and waits for the next one, false at
+        // the end of the file
+        bool next();
+        void restart(std::uint64_t position);
+
+        int fd;
+        std::uint64_t fileSize;
+        std::size_t chunkSize;
+        std::vector<Chunk> ring;
+        // file position of the start of the get area
+        std::uint64_t base = 0;
+        bool holding = false;
+
+        // shared with the I/O thread
+        std::mutex mutex;
+        std::condition_variable changed;
+        // chunks filled and chunks released, ring slots are taken in turn
+        std::uint64_t produced = 0;
+        std::uint64_t consumed = 0;
+        // where the next chunk is read from
+        std::uint64_t readPosition = 0;
+        // bumped by restart() so that a read in flight is dropped
+        std::uint64_t generation = 0;
+        bool stopping = false;
+        std::string error;
+        std::thread thread;
+    };
+
     // WARNING:
     // this assumes that float is 32bit and double is 64bit
     // both conforming to IEEE 754, it does not assume endianness
     // it also assumes that signed integers are two's complement
     class Reader {
     public:
-        Reader(std::ifstream *input);
+        Reader(std::istream *input);
         Reader(char *input);
+        // bounded in-memory input, if owner is set readBuffer() returns views
+        // into input instead of copies
+        Reader(const char *input, std::size_t size, std::shared_ptr<const void> owner = nullptr);
 
         std::uint8_t readUint8();
         std::int8_t readInt8();
@@ -29,16 +198,61 @@ namespace fbx {
         float readFloat();
         double readDouble();
 
-        void read(char*, uint32_t);
+        void read(char*, std::size_t);
+        // alignment: views are only handed out if they are aligned to it
+        SharedBuffer readBuffer(std::size_t length, std::size_t alignment = 1);
+
+        // buffers copied by readBuffer() are allocated from the arena
+        void setArena(std::shared_ptr<Arena> arena);
+        const std::shared_ptr<Arena> &getArena();
+
+        // pool for node names and short strings
+        void setStringPool(std::shared_ptr<StringPool> pool);
+        const std::shared_ptr<StringPool> &getStringPool();
+        // like readBuffer() but copies are interned in the string pool
+        SharedBuffer readInterned(std::size_t length);
+
+        // memory backed readers only, returns pointer to the next length bytes
+        bool isMemoryBacked();
+        // true if readBuffer() hands out views instead of copies
+        bool returnsViews();
+        const char *readView(std::size_t length);
+        // view of length bytes at position if the input has an owner, empty
+        // otherwise, doesn't move the read position
+        SharedBuffer viewAt(std::uint64_t position, std::size_t length);
+
+        // position from the start of the input
+        std::uint64_t tell();
+        void seek(std::uint64_t position);
     private:
         uint8_t getc();
-        std::ifstream *ifstream;
-        char *buffer;
-        uint32_t i;
+        const char *advance(std::size_t length);
+        std::istream *stream;
+        const char *buffer;
+        std::size_t i;
+        std::size_t size;
+        std::shared_ptr<const void> owner;
+        std::shared_ptr<Arena> arena;
+        std::shared_ptr<StringPool> strings;
     };
+
+    // reads and checks the "Kaydara FBX Binary" magic at the start of a file
+    bool checkMagic(Reader &reader);
+
+    // Buffers output in a large owned buffer and hands it to the sink (stream,
+    // memory buffer or file descriptor) in big chunks. Whatever is left is
+    // flushed on destruction, call flush() to see errors.
     class Writer {
     public:
-        Writer(std::ofstream *output);
+        Writer(std::ostream *output);
+        Writer(std::vector<std::uint8_t> *output);
+        // bufferSize: bytes collected before they are appended to output,
+        // small buffers suit short outputs such as single values
+        Writer(std::vector<std::uint8_t> *output, std::size_t bufferSize);
+        Writer(int fd);
+        ~Writer();
+        Writer(const Writer&) = delete;
+        Writer &operator=(const Writer&) = delete;
 
         void write(std::uint8_t);
         void write(std::int8_t);
@@ -48,13 +262,41 @@ namespace fbx {
         void write(std::int32_t);
         void write(std::uint64_t);
         void write(std::int64_t);
-        void write(std::string);
+        void write(std::string_view);
         void write(float);
         void write(double);
+        // bulk append of bytes as they are
+        void write(const std::uint8_t *data, std::size_t length);
+
+        // bytes written since the writer was created
+        std::uint64_t tell();
+        // overwrites already written bytes at position (as returned by tell()),
+        // output that was handed to the sink already needs a seekable
+        // stream or file
+        void patch(std::uint64_t position, const std::uint8_t *data, std::size_t length);
+
+        void flush();
     private:
         void putc(uint8_t);
-        std::ofstream *ofstream;
+        void drain(const std::uint8_t *data, std::size_t length);
+        void patchSink(std::uint64_t position, const std::uint8_t *data, std::size_t length);
+        std::ostream *ostream;
+        std::vector<std::uint8_t> *vector;
+        int fd;
+        std::vector<std::uint8_t> buffer;
+        std::size_t used;
+        // bytes handed to the sink and where the sink was when we started
+        std::uint64_t drained;
+        std::uint64_t origin;
     };
+
+    // magic and version that start a file, footer that ends it
+    void writeHeader(Writer &writer, std::uint32_t version);
+    void writeFooter(Writer &writer, std::uint32_t version);
+    // throws if version is newer than the latest supported one
+    void checkVersion(std::uint32_t version);
+    // throws if endOffset doesn't fit the node record layout of version
+    void checkEndOffset(std::uint64_t endOffset, std::uint32_t version);
 }
 
 #endif // FBXUTIL_H
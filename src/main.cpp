@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <iostream>
+#include <thread>
 
 #include "fbxdocument.h"
 
@@ -16,12 +17,19 @@ int main(int argc, char** argv)
 
     try {
         fbx::FBXDocument doc;
+        fbx::FBXReadOptions options;
+        // arrays are written back with the bytes they were read with, no
+        // need to inflate them at all
+        options.lazyDecompression = true;
         std::cout << "Reading " << argv[1] << std::endl;
-        doc.read(argv[1]);
+        doc.read(argv[1], options);
 
         //doc.print();
+        fbx::FBXWriteOptions writeOptions;
+        writeOptions.compressArrays = true;
+        writeOptions.compressionThreads = std::thread::hardware_concurrency();
         std::cout << "Writing test.fbx" << std::endl;
-        doc.write("test.fbx");
+        doc.write("test.fbx", writeOptions);
     } catch(std::string e) {
         std::cout << e << std::endl;
         return 2;